@@ -0,0 +1,157 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "AsyncWriter.h"
+
+/*============================================================================*/
+
+/*===================================\\
+|| Async writer class implementation ||
+\\===================================*/
+
+/*============================================================================*/
+
+// Constructor
+// Allocates the buffer pool (buffers grow on demand) and starts the writer
+// thread. At least two buffers are used, since a SeriesWriter keeps one while
+// it fills it.
+AsyncWriter::AsyncWriter (int p_NUM_BUFFERS) {
+  NUM_BUFFERS = p_NUM_BUFFERS > 2 ? p_NUM_BUFFERS : 2;
+  free_buffers = (AsyncBuffer*) malloc(NUM_BUFFERS*sizeof(AsyncBuffer));
+  for (int b = 0; b < NUM_BUFFERS; b++) {
+    free_buffers[b].data = NULL;
+    free_buffers[b].capacity = 0;
+  }
+  num_free = NUM_BUFFERS;
+  stop = false;
+  busy = false;
+  failed = false;
+  thread = std::thread(&AsyncWriter::run, this);
+}
+
+/*============================================================================*/
+
+// Destructor
+// Finishes all pending writes, then stops the writer thread.
+AsyncWriter::~AsyncWriter () {
+  {
+    std::unique_lock<std::mutex> lock(mtx);
+    stop = true;
+  }
+  work.notify_one();
+  thread.join();
+  for (int b = 0; b < num_free; b++) {
+    free(free_buffers[b].data);
+  }
+  free(free_buffers);
+}
+
+/*============================================================================*/
+
+// Takes a buffer of at least size bytes from the pool, waiting for one to be
+// returned if all are in use
+AsyncBuffer AsyncWriter::acquire (size_t size) {
+  AsyncBuffer buf;
+  {
+    std::unique_lock<std::mutex> lock(mtx);
+    while (num_free == 0) space.wait(lock);
+    buf = free_buffers[--num_free];
+  }
+  if (buf.capacity < size) {
+    buf.data = (uint8_t*) realloc(buf.data, size);
+    buf.capacity = size;
+  }
+  return buf;
+}
+
+/*============================================================================*/
+
+// Queues the first size bytes of an acquired buffer to be written to file at
+// the given offset (appended if offset < 0); the buffer goes back to the
+// pool once written
+void AsyncWriter::submit (FILE* file, AsyncBuffer buf, size_t size, long offset) {
+  Job job;
+  job.file = file;
+  job.buf = buf;
+  job.size = size;
+  job.offset = offset;
+  job.close = false;
+  {
+    std::unique_lock<std::mutex> lock(mtx);
+    queue.push_back(job);
+  }
+  work.notify_one();
+}
+
+/*============================================================================*/
+
+// Queues closing file after all its pending writes
+void AsyncWriter::close (FILE* file) {
+  Job job;
+  job.file = file;
+  job.buf.data = NULL;
+  job.buf.capacity = 0;
+  job.size = 0;
+  job.offset = -1;
+  job.close = true;
+  {
+    std::unique_lock<std::mutex> lock(mtx);
+    queue.push_back(job);
+  }
+  work.notify_one();
+}
+
+/*============================================================================*/
+
+// Waits until all queued jobs are done
+void AsyncWriter::drain () {
+  std::unique_lock<std::mutex> lock(mtx);
+  while (!queue.empty() || busy) idle.wait(lock);
+}
+
+/*============================================================================*/
+
+// Returns false if any write or close done so far has failed (call drain
+// first to include the queued ones)
+bool AsyncWriter::ok () {
+  return !failed;
+}
+
+/*============================================================================*/
+
+// Writer thread: runs jobs in order until stopped and the queue is empty
+void AsyncWriter::run () {
+
+  Job job;
+
+  while (true) {
+
+    {
+      std::unique_lock<std::mutex> lock(mtx);
+      while (queue.empty() && !stop) work.wait(lock);
+      if (queue.empty()) break;
+      job = queue.front();
+      queue.pop_front();
+      busy = true;
+    }
+
+    if (job.close) {
+      if (fclose(job.file) != 0) failed = true;
+    } else {
+      if (job.offset >= 0 && fseek(job.file, job.offset, SEEK_SET) != 0) failed = true;
+      if (fwrite(job.buf.data, 1, job.size, job.file) != job.size) failed = true;
+      if (job.offset >= 0) fseek(job.file, 0, SEEK_END);
+    }
+
+    {
+      std::unique_lock<std::mutex> lock(mtx);
+      if (!job.close) free_buffers[num_free++] = job.buf;
+      busy = false;
+      if (queue.empty()) idle.notify_all();
+    }
+    if (!job.close) space.notify_one();
+
+  }
+
+}
+
+/*============================================================================*/
@@ -0,0 +1,85 @@
+#ifndef ASYNC_WRITER_H
+#define ASYNC_WRITER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+/*================================\\
+|| Async writer class declaration ||
+\\================================*/
+
+// Background output thread with a pool of reusable buffers.
+// The simulation acquires a buffer, fills it (e.g. with a packed grid), and
+// submits it for writing; a writer thread drains the submitted writes to
+// disk in order and returns the buffers to the pool. Since there are only
+// NUM_BUFFERS buffers, the queue is bounded: acquire() blocks only when all
+// buffers are still waiting to be written.
+// Used through SeriesWriter and SnapshotWriter (see Series.h, Snapshot.h).
+
+// A pooled buffer
+struct AsyncBuffer {
+  uint8_t* data;
+  size_t capacity;
+};
+
+class AsyncWriter {
+
+  public:
+
+  /*==========================================================================*/
+
+  /* MEMBER VARIABLES */
+
+  // A pending write of size bytes of buf to file, at the given offset (or
+  // appended if offset < 0), or a request to close file if close is set
+  struct Job {
+    FILE* file;
+    AsyncBuffer buf;
+    size_t size;
+    long offset;
+    bool close;
+  };
+
+  // Buffer pool
+  // free_buffers[NUM_BUFFERS], num_free of them currently available
+  int NUM_BUFFERS;
+  AsyncBuffer* free_buffers;
+  int num_free;
+
+  // Pending jobs, in submission order
+  std::deque<Job> queue;
+
+  // Synchronization: mtx guards everything above; work is signaled on new
+  // jobs, space when a buffer is returned, idle when the queue is empty
+  std::mutex mtx;
+  std::condition_variable work, space, idle;
+  bool stop;
+  bool busy;
+
+  // Set by the writer thread when a write (or closing a file) fails, so
+  // that the producers can tell that output was lost (see ok)
+  std::atomic<bool> failed;
+
+  std::thread thread;
+
+  /*==========================================================================*/
+
+  /* MEMBER FUNCTIONS */
+
+  AsyncWriter(int);
+  ~AsyncWriter();
+  AsyncBuffer acquire(size_t);
+  void submit(FILE*, AsyncBuffer, size_t, long);
+  void close(FILE*);
+  void drain();
+  bool ok();
+  void run();
+
+};
+
+#endif // ASYNC_WRITER_H
@@ -0,0 +1,380 @@
+#include <stdio.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "IsingModel.h"
+#include "BatchIsingModel.h"
+#include "Checkpoint.h"
+
+/*============================================================================*/
+
+/*===============================================================\\
+|| Batched (multi-replica) Ising Model engine implementation     ||
+\\===============================================================*/
+
+/*============================================================================*/
+
+// Bit-sliced counters
+// The 64 counters of a word (one per replica) are stored as NUM_PLANES bit
+// planes: bit r of plane[p] is bit p of counter r. Adding a word of flags to
+// all counters then takes a few word operations (a ripple carry), however
+// many replicas there are. Counts must stay below 2^NUM_PLANES.
+static const int NUM_PLANES = 32;
+
+// Adds 1 to the counters of the bits set in x
+static inline void count_bits (uint64_t* plane, uint64_t x) {
+  uint64_t carry;
+  for (int p = 0; x; p++) {
+    carry = plane[p] & x;
+    plane[p] ^= x;
+    x = carry;
+  }
+}
+
+// Returns counter r
+static inline int read_count (const uint64_t* plane, int r) {
+  int count = 0;
+  for (int p = 0; p < NUM_PLANES; p++) {
+    count |= (int) ((plane[p] >> r) & 1) << p;
+  }
+  return count;
+}
+
+/*============================================================================*/
+
+// Constructor
+// Grid size, temperature and number of replicas (1 to MAX_REPLICAS) must be
+// provided.
+BatchIsingModel::BatchIsingModel (int p_NGRID, double p_TEMP, int p_NUM_REPLICAS) {
+
+  TEMP = p_TEMP;
+  NGRID = p_NGRID;
+  NCELLS = NGRID*NGRID;
+  NUM_REPLICAS = p_NUM_REPLICAS;
+  START_GEN = 1;
+
+  if (NUM_REPLICAS < 1 || NUM_REPLICAS > MAX_REPLICAS) {
+    fprintf(stderr, "BatchIsingModel: NUM_REPLICAS must be 1 to %i (got %i)\n", MAX_REPLICAS, NUM_REPLICAS);
+    exit(1);
+  }
+  if (NUM_REPLICAS == 64) {
+    replica_mask = ~0ULL;
+  } else {
+    replica_mask = (1ULL << NUM_REPLICAS) - 1;
+  }
+
+  // Allocate the packed grids (all spins down) and statistics
+  words = (uint64_t*) calloc(NCELLS, sizeof(uint64_t));
+  global_energy = (int*) malloc(NUM_REPLICAS*sizeof(int));
+  global_magnetization = (double*) malloc(NUM_REPLICAS*sizeof(double));
+  global_mean = (double*) malloc(NUM_REPLICAS*sizeof(double));
+  global_variance = (double*) malloc(NUM_REPLICAS*sizeof(double));
+  global_M2 = (double*) malloc(NUM_REPLICAS*sizeof(double));
+  equil = (EquilibriumStats*) malloc(NUM_REPLICAS*sizeof(EquilibriumStats));
+
+  trans_dynamics = IsingModel::DYNAMICS_METROPOLIS;
+  update_acceptance();
+
+  reset_stats();
+  cur_gen = 0;
+
+  // Seed RNG (the user may reseed with setSeed)
+  setSeed(time(NULL));
+
+}
+
+/*============================================================================*/
+
+// Destructor
+BatchIsingModel::~BatchIsingModel () {
+  free(words);
+  free(global_energy);
+  free(global_magnetization);
+  free(global_mean);
+  free(global_variance);
+  free(global_M2);
+  free(equil);
+}
+
+/*============================================================================*/
+
+// Reset all stats
+void BatchIsingModel::reset_stats () {
+  for (int r = 0; r < NUM_REPLICAS; r++) {
+    global_energy[r] = 0;
+    global_magnetization[r] = 0.0;
+    global_mean[r] = 0.0;
+    global_variance[r] = 0.0;
+    global_M2[r] = 0.0;
+    equil[r].reset();
+  }
+  global_npoints = 0;
+}
+
+/*============================================================================*/
+
+// Tabulates the flip acceptance probabilities for the current temperature
+// and dynamics (see MSCIsingModel::update_acceptance)
+void BatchIsingModel::update_acceptance () {
+  int k, deltaE;
+  double prob;
+  for (k = 0; k <= 4; k++) {
+    deltaE = 8 - 4*k;
+    if (trans_dynamics == IsingModel::DYNAMICS_GLAUBER) {
+      prob = 1/(1 + exp(deltaE/TEMP));
+    } else {
+      if (deltaE <= 0) prob = 1.0;
+      else prob = exp(-deltaE/TEMP);
+    }
+    if (prob >= 1.0) {
+      accept_prob[k] = ACCEPT_ALWAYS;
+    } else {
+      accept_prob[k] = (uint64_t) floor(prob*4294967296.0);
+    }
+  }
+  table_temp = TEMP;
+  table_dynamics = trans_dynamics;
+}
+
+/*============================================================================*/
+
+// Sets the temperature and updates the acceptance table
+void BatchIsingModel::setTemperature (double p_TEMP) {
+  TEMP = p_TEMP;
+  update_acceptance();
+}
+
+/*============================================================================*/
+
+// Sets the transition dynamics and updates the acceptance table
+void BatchIsingModel::setDynamics (int p_dynamics) {
+  if (p_dynamics != IsingModel::DYNAMICS_METROPOLIS &&
+      p_dynamics != IsingModel::DYNAMICS_GLAUBER) {
+    fprintf(stderr, "BatchIsingModel: only Metropolis and Glauber dynamics supported\n");
+    exit(1);
+  }
+  trans_dynamics = p_dynamics;
+  update_acceptance();
+}
+
+/*============================================================================*/
+
+// Sets the spins of every replica to get a magnetization close to the given
+// value (see IsingModel::set_magnetization)
+void BatchIsingModel::set_magnetization (double magn) {
+  uint64_t prob;
+  double p = (magn+1)/2.0;
+  if (p >= 1.0) prob = ACCEPT_ALWAYS;
+  else if (p <= 0.0) prob = 0;
+  else prob = (uint64_t) floor(p*4294967296.0);
+  for (int c = 0; c < NCELLS; c++) {
+    words[c] = rng.bernoulli_word(prob, replica_mask);
+  }
+  update_magnetization();
+}
+
+/*============================================================================*/
+
+// Computes the current energy of every replica
+// Every right and down bond contributes -1 if aligned and +1 otherwise; the
+// anti-aligned bonds of all replicas are counted at once with bit-sliced
+// counters.
+void BatchIsingModel::update_energy () {
+  int i, j, r;
+  uint64_t plane[NUM_PLANES];
+  const uint64_t *row, *down;
+  memset(plane, 0, sizeof(plane));
+  for (i = 0; i < NGRID; i++) {
+    row = &words[i*NGRID];
+    down = &words[((i+1)%NGRID)*NGRID];
+    for (j = 0; j < NGRID-1; j++) {
+      count_bits(plane, row[j] ^ row[j+1]);
+      count_bits(plane, row[j] ^ down[j]);
+    }
+    count_bits(plane, row[NGRID-1] ^ row[0]);
+    count_bits(plane, row[NGRID-1] ^ down[NGRID-1]);
+  }
+  for (r = 0; r < NUM_REPLICAS; r++) {
+    global_energy[r] = 2*read_count(plane, r) - 2*NCELLS;
+  }
+}
+
+/*============================================================================*/
+
+// Computes the current magnetization of every replica
+void BatchIsingModel::update_magnetization () {
+  int c, r;
+  uint64_t plane[NUM_PLANES];
+  memset(plane, 0, sizeof(plane));
+  for (c = 0; c < NCELLS; c++) {
+    count_bits(plane, words[c]);
+  }
+  for (r = 0; r < NUM_REPLICAS; r++) {
+    global_magnetization[r] = (2*read_count(plane, r) - NCELLS)/(double)(NCELLS);
+  }
+}
+
+/*============================================================================*/
+
+// Reseeds the random number generator
+void BatchIsingModel::setSeed (uint64_t p_seed) {
+  seed = p_seed;
+  rng.seed(seed, 0);
+}
+
+/*============================================================================*/
+
+// Saves the full state of the model to a checkpoint file
+// (see IsingModel::saveCheckpoint)
+bool BatchIsingModel::saveCheckpoint (const char* fname) {
+  CheckpointWriter ckp;
+  ckp.open(fname, "BAT1");
+  ckp.put(NGRID);
+  ckp.put(NUM_REPLICAS);
+  ckp.put(TEMP);
+  ckp.put(trans_dynamics);
+  ckp.put(START_GEN);
+  ckp.put(cur_gen);
+  ckp.put_array(words, NCELLS);
+  ckp.put_array(global_energy, NUM_REPLICAS);
+  ckp.put_array(global_magnetization, NUM_REPLICAS);
+  ckp.put_array(global_mean, NUM_REPLICAS);
+  ckp.put_array(global_variance, NUM_REPLICAS);
+  ckp.put_array(global_M2, NUM_REPLICAS);
+  ckp.put(global_npoints);
+  ckp.put_array(equil, NUM_REPLICAS);
+  ckp.put(seed);
+  ckp.put(rng);
+  return ckp.close();
+}
+
+/*============================================================================*/
+
+// Restores the full state of the model from a checkpoint written by
+// saveCheckpoint (see IsingModel::loadCheckpoint)
+bool BatchIsingModel::loadCheckpoint (const char* fname) {
+  CheckpointReader ckp;
+  if (!ckp.open(fname, "BAT1")) return ckp.close();
+  ckp.expect(NGRID);
+  ckp.expect(NUM_REPLICAS);
+  if (!ckp.ok) return ckp.close();
+  ckp.get(TEMP);
+  ckp.get(trans_dynamics);
+  ckp.get(START_GEN);
+  ckp.get(cur_gen);
+  ckp.get_array(words, NCELLS);
+  ckp.get_array(global_energy, NUM_REPLICAS);
+  ckp.get_array(global_magnetization, NUM_REPLICAS);
+  ckp.get_array(global_mean, NUM_REPLICAS);
+  ckp.get_array(global_variance, NUM_REPLICAS);
+  ckp.get_array(global_M2, NUM_REPLICAS);
+  ckp.get(global_npoints);
+  ckp.get_array(equil, NUM_REPLICAS);
+  ckp.get(seed);
+  ckp.get(rng);
+  update_acceptance();
+  return ckp.close();
+}
+
+/*============================================================================*/
+
+// Advances all replicas by one generation (one attempted flip per cell)
+// The cells are visited as a checkerboard, first those with i+j even and
+// then the rest. For each cell, the number k of anti-aligned neighbors in
+// every replica is obtained with a bit-sliced adder, and the replicas of
+// every class k are flipped with its acceptance probability, drawing
+// independent random bits for each replica. The energies and magnetizations
+// are then recomputed.
+void BatchIsingModel::doGeneration () {
+
+  int color, i, j, jl, jr, k;
+  uint64_t *row;
+  const uint64_t *up, *down;
+  uint64_t s, a1, a2, a3, a4, s1, c1, s2, c2, carry, ones, twos, fours;
+  uint64_t cls, flip;
+
+  // Rebuild the acceptance table if TEMP or trans_dynamics were modified
+  if (TEMP != table_temp || trans_dynamics != table_dynamics) {
+    update_acceptance();
+  }
+
+  for (color = 0; color < 2; color++) {
+    for (i = 0; i < NGRID; i++) {
+      row = &words[i*NGRID];
+      up = &words[((i+NGRID-1)%NGRID)*NGRID];
+      down = &words[((i+1)%NGRID)*NGRID];
+      for (j = (i+color)%2; j < NGRID; j += 2) {
+
+        jl = (j == 0) ? NGRID-1 : j-1;
+        jr = (j == NGRID-1) ? 0 : j+1;
+
+        // Anti-aligned neighbor flags
+        s = row[j];
+        a1 = s ^ up[j];
+        a2 = s ^ down[j];
+        a3 = s ^ row[jl];
+        a4 = s ^ row[jr];
+
+        // Bit-sliced count k = a1+a2+a3+a4 = ones + 2*twos + 4*fours
+        s1 = a1 ^ a2;
+        c1 = a1 & a2;
+        s2 = a3 ^ a4;
+        c2 = a3 & a4;
+        ones = s1 ^ s2;
+        carry = s1 & s2;
+        twos = c1 ^ c2 ^ carry;
+        fours = (c1 & c2) | ((c1 ^ c2) & carry);
+
+        // Accept flips class by class
+        flip = 0;
+        for (k = 0; k <= 4; k++) {
+          switch (k) {
+            case 0: cls = ~ones & ~twos & ~fours; break;
+            case 1: cls = ones & ~twos & ~fours; break;
+            case 2: cls = ~ones & twos; break;
+            case 3: cls = ones & twos; break;
+            default: cls = fours; break;
+          }
+          cls &= replica_mask;
+          if (!cls) continue;
+          flip |= rng.bernoulli_word(accept_prob[k], cls);
+        }
+        row[j] = s ^ flip;
+
+      }
+    }
+  }
+
+  update_energy();
+  update_magnetization();
+
+  // Update stats
+  cur_gen++;
+  if (cur_gen>=START_GEN) {
+    update_stats();
+  }
+
+}
+
+/*============================================================================*/
+
+// Updates the mean and variance of the magnetization of every replica
+// (see IsingModel::update_stats)
+void BatchIsingModel::update_stats () {
+  double delta;
+  global_npoints++;
+  for (int r = 0; r < NUM_REPLICAS; r++) {
+    delta = global_magnetization[r] - global_mean[r];
+    global_mean[r] = global_mean[r] + delta/global_npoints;
+    global_M2[r] = global_M2[r] + delta*(global_magnetization[r] - global_mean[r]);
+    if (global_npoints==1) {
+      global_variance[r] = 0.0;
+    } else {
+      global_variance[r] = global_M2[r]/(global_npoints-1);
+    }
+    equil[r].add(cur_gen, global_magnetization[r], global_energy[r]/(double)NCELLS);
+  }
+}
+
+/*============================================================================*/
@@ -0,0 +1,138 @@
+#ifndef BATCH_ISING_H
+#define BATCH_ISING_H
+
+#include <stdint.h>
+#include "Random.h"
+#include "Binning.h"
+
+/*==============================================================\\
+|| Batched (multi-replica) Ising Model engine declaration       ||
+\\==============================================================*/
+
+// Engine that simulates up to 64 independent replicas of the plain
+// (undiluted) 2D nearest-neighbor model at the same temperature in lockstep,
+// using asynchronous multi-spin coding: the spins of one cell in all the
+// replicas are packed into a single 64-bit word, so every bitwise operation
+// updates that cell in all replicas at once. Every replica draws its own
+// random bits, so the replicas are statistically independent, and their
+// energies and magnetizations are kept separately.
+// Meant for many runs of small lattices (see ENGINE_BATCH in ising.cpp); a
+// single large run is better served by MSCIsingModel. The cells are swept as
+// a checkerboard. Dead cells and sample statistics are not supported, and
+// only Metropolis and Glauber dynamics are.
+
+class BatchIsingModel {
+
+  public:
+
+  /*==========================================================================*/
+
+  /* MEMBER VARIABLES */
+
+  // Temperature, in units of J/k
+  double TEMP;
+
+  // Size of grid (NGRID x NGRID)
+  // At most MAX_NGRID: the cell counts and energy sums are int, and the
+  // count of anti-aligned bonds reaches 4*NCELLS in the energy.
+  static const int MAX_NGRID = 23170;
+  int NGRID;
+
+  // Total number of cells, equal to NGRID*NGRID
+  int NCELLS;
+
+  // Number of replicas (at most MAX_REPLICAS), and mask of their bits
+  static const int MAX_REPLICAS = 64;
+  int NUM_REPLICAS;
+  uint64_t replica_mask;
+
+  // Bit-packed spin states
+  // Bit r of words[i*NGRID+j] holds cell (i,j) of replica r; a set bit is
+  // spin +1. Bits of unused replicas are always zero.
+  // words[NCELLS]
+  uint64_t* words;
+
+  // Dynamics, one of IsingModel::DYNAMICS_METROPOLIS or DYNAMICS_GLAUBER
+  int trans_dynamics;
+
+  // Flip acceptance probabilities as 32-bit fixed point numbers, indexed by
+  // the number k of anti-aligned neighbors (deltaE = 8-4k), as in
+  // MSCIsingModel. A value of ACCEPT_ALWAYS means the flip is certain.
+  static const uint64_t ACCEPT_ALWAYS = 1ULL << 32;
+  uint64_t accept_prob[5];
+  double table_temp;
+  int table_dynamics;
+
+  // Random number generator and its seed (shared by all replicas)
+  uint64_t seed;
+  IsingRNG rng;
+
+  // Current generation (will never reset)
+  int cur_gen;
+
+  // Generation in which to start recording stats
+  int START_GEN;
+
+  // Statistics of each replica, with the same meaning as in IsingModel
+  // global_energy[NUM_REPLICAS], ...
+  int* global_energy;
+  double* global_magnetization;
+  double* global_mean;
+  double* global_variance;
+  double* global_M2;
+  int global_npoints;
+
+  // Equilibration and error analysis of |M| and E of each replica (see
+  // IsingModel)
+  // equil[NUM_REPLICAS]
+  EquilibriumStats* equil;
+
+  /*==========================================================================*/
+
+  /* MEMBER FUNCTIONS */
+
+  BatchIsingModel(int, double, int);
+  ~BatchIsingModel();
+  void reset_stats();
+  void update_acceptance();
+  void setTemperature(double);
+  void setDynamics(int);
+  void set_magnetization(double);
+  void update_energy();
+  void update_magnetization();
+  void doGeneration();
+  void update_stats();
+  void setSeed(uint64_t);
+  bool saveCheckpoint(const char*);
+  bool loadCheckpoint(const char*);
+
+  // Spin of cell (i,j) in replica r
+  inline int get_spin(int r, int i, int j) {
+    return ((words[i*NGRID + j] >> r) & 1) ? +1 : -1;
+  }
+
+};
+
+/*============================================================================*/
+
+// One replica of a BatchIsingModel, seen through the NGRID/get_spin(i,j)
+// interface of the single-replica engines (e.g. to write its snapshots)
+struct BatchReplica {
+
+  BatchIsingModel* model;
+  int replica;
+  int NGRID;
+
+  BatchReplica (BatchIsingModel* p_model, int p_replica) {
+    model = p_model;
+    replica = p_replica;
+    NGRID = model->NGRID;
+  }
+
+  inline int get_spin(int i, int j) {
+    return model->get_spin(replica, i, j);
+  }
+
+};
+
+#endif // BATCH_ISING_H
@@ -0,0 +1,362 @@
+#ifndef BINNING_H
+#define BINNING_H
+
+#include <math.h>
+#include <string.h>
+
+// Streaming error analysis of correlated time series.
+
+// The models feed their magnetization and energy into these accumulators
+// every generation (see IsingModel::update_stats), so the means of their
+// moments, with their errors and integrated autocorrelation times, and the
+// susceptibility, specific heat and Binder cumulant with jackknife errors,
+// are known during the run without storing the series, in O(log n) memory.
+// ising.cpp uses them to stop a run once <|M|> is known to the requested
+// precision, and writes them to a summary file at the end of each run.
+
+// The accumulators hold no pointers, so the models save them to their
+// checkpoints as they are.
+
+/*============================================================================*/
+
+/*======================\
+| Logarithmic binning |
+\======================*/
+
+// Flyvbjerg-Petersen blocking analysis of one observable
+// Level k sees the series averaged in blocks of 2^k consecutive values, and
+// accumulates the count, sum and sum of squares of its blocks (a block is
+// kept pending until its pair arrives). The naive error of the mean at level
+// k grows with k while the blocks are shorter than the autocorrelation time,
+// and levels off at the true error once they are longer. Only levels with at
+// least MIN_BLOCKS blocks are trusted.
+struct LogBinning {
+
+  static const int MAX_LEVELS = 40;
+  static const int MIN_BLOCKS = 32;
+
+  // Number of levels with at least one block
+  int nlevels;
+
+  // Blocks of each level: their number, sum and sum of squares, and the
+  // block waiting for its pair
+  long count[MAX_LEVELS];
+  double sum[MAX_LEVELS];
+  double sum2[MAX_LEVELS];
+  double pending[MAX_LEVELS];
+  bool has_pending[MAX_LEVELS];
+
+  void reset () {
+    nlevels = 0;
+    memset(count, 0, sizeof(count));
+    memset(sum, 0, sizeof(sum));
+    memset(sum2, 0, sizeof(sum2));
+    memset(pending, 0, sizeof(pending));
+    memset(has_pending, 0, sizeof(has_pending));
+  }
+
+  // Adds the next value of the series
+  // Each value completes blocks at about two levels on average.
+  inline void add (double x) {
+    for (int k = 0; k < MAX_LEVELS; k++) {
+      count[k]++;
+      sum[k] += x;
+      sum2[k] += x*x;
+      if (k >= nlevels) nlevels = k+1;
+      if (!has_pending[k]) {
+        pending[k] = x;
+        has_pending[k] = true;
+        return;
+      }
+      x = 0.5*(pending[k] + x);
+      has_pending[k] = false;
+    }
+  }
+
+  // Number of values added
+  long size () const {
+    return count[0];
+  }
+
+  double mean () const {
+    return count[0] > 0 ? sum[0]/count[0] : 0.0;
+  }
+
+  // Error of the mean as if the blocks of level k were independent
+  double level_error (int k) const {
+    long n = count[k];
+    double m, var;
+    if (n < 2) return 0.0;
+    m = sum[k]/n;
+    var = (sum2[k]/n - m*m)*n/(n-1);
+    return var > 0 ? sqrt(var/n) : 0.0;
+  }
+
+  // Highest level with at least MIN_BLOCKS blocks (-1 if none)
+  int top_level () const {
+    int k = nlevels-1;
+    while (k >= 0 && count[k] < MIN_BLOCKS) k--;
+    return k;
+  }
+
+  // Error of the mean: the largest over the trusted levels
+  double error () const {
+    double err = 0.0, e;
+    int k, top = top_level();
+    for (k = 0; k <= top; k++) {
+      e = level_error(k);
+      if (e > err) err = e;
+    }
+    return err;
+  }
+
+  // Integrated autocorrelation time, in values (1/2 for uncorrelated ones),
+  // from var(mean) = 2*tau*var/n
+  double tau () const {
+    double e0 = level_error(0), e = error();
+    return e0 > 0 ? 0.5*(e*e)/(e0*e0) : 0.0;
+  }
+
+  // Has the error levelled off? True when the errors of the two highest
+  // trusted levels agree within the statistical uncertainty of the highest,
+  // about 1/sqrt(2(n-1)) for n blocks
+  bool converged () const {
+    int top = top_level();
+    double e1, e0;
+    if (top < 2) return false;
+    e1 = level_error(top);
+    e0 = level_error(top-1);
+    return fabs(e1 - e0) <= e1/sqrt(2.0*(count[top]-1));
+  }
+
+};
+
+/*============================================================================*/
+
+/*================\
+| Jackknife bins |
+\================*/
+
+// Observables accumulated by JackknifeBins, per generation: the energy per
+// cell e and the magnetization per cell m
+const int OBS_E = 0;    // e
+const int OBS_E2 = 1;   // e^2
+const int OBS_M = 2;    // |m|
+const int OBS_M2 = 3;   // m^2
+const int OBS_M4 = 4;   // m^4
+
+// Sums of the observables over consecutive bins of the series, for jackknife
+// errors of nonlinear functions of their means (susceptibility, specific heat
+// and Binder cumulant)
+// Bins start with one value each; when MAX_BINS are full adjacent pairs are
+// merged and the bin size doubles, so there are always between MAX_BINS/2
+// and MAX_BINS full bins, eventually much longer than the autocorrelation
+// time. The partially filled bin is left out of the estimates.
+struct JackknifeBins {
+
+  static const int NUM_OBS = 5;
+  static const int MAX_BINS = 64;
+
+  // Values per full bin, and number of full bins
+  long bin_size;
+  int nbins;
+
+  // Sums over each full bin, and over the partial one
+  double bins[MAX_BINS][NUM_OBS];
+  double cur[NUM_OBS];
+  long cur_count;
+
+  void reset () {
+    bin_size = 1;
+    nbins = 0;
+    memset(bins, 0, sizeof(bins));
+    memset(cur, 0, sizeof(cur));
+    cur_count = 0;
+  }
+
+  // Adds the observables of the next value of the series
+  void add (const double* x) {
+    int b, k;
+    for (k = 0; k < NUM_OBS; k++) cur[k] += x[k];
+    if (++cur_count < bin_size) return;
+    memcpy(bins[nbins++], cur, sizeof(cur));
+    memset(cur, 0, sizeof(cur));
+    cur_count = 0;
+    if (nbins < MAX_BINS) return;
+    for (b = 0; b < MAX_BINS/2; b++) {
+      for (k = 0; k < NUM_OBS; k++) bins[b][k] = bins[2*b][k] + bins[2*b+1][k];
+    }
+    nbins = MAX_BINS/2;
+    bin_size *= 2;
+  }
+
+  // Jackknife estimate of f(means of the observables) and its error
+  // f is evaluated on the means of all full bins (the value) and on those
+  // leaving out each bin in turn (the spread gives the error). The error is
+  // zero with fewer than two bins.
+  void estimate (double (*f)(const double* mean, double ncells, double temp),
+                 double ncells, double temp, double& val, double& err) const {
+    double total[NUM_OBS], mean[NUM_OBS], fj[MAX_BINS];
+    double fmean = 0.0, var = 0.0;
+    int b, k;
+    memset(total, 0, sizeof(total));
+    for (b = 0; b < nbins; b++) {
+      for (k = 0; k < NUM_OBS; k++) total[k] += bins[b][k];
+    }
+    for (k = 0; k < NUM_OBS; k++) mean[k] = nbins > 0 ? total[k]/(nbins*bin_size) : 0.0;
+    val = f(mean, ncells, temp);
+    err = 0.0;
+    if (nbins < 2) return;
+    for (b = 0; b < nbins; b++) {
+      for (k = 0; k < NUM_OBS; k++) mean[k] = (total[k] - bins[b][k])/((nbins-1)*bin_size);
+      fj[b] = f(mean, ncells, temp);
+      fmean += fj[b];
+    }
+    fmean /= nbins;
+    for (b = 0; b < nbins; b++) var += (fj[b] - fmean)*(fj[b] - fmean);
+    err = sqrt(var*(nbins-1)/nbins);
+  }
+
+};
+
+// Functions of the means of the observables, for JackknifeBins::estimate
+// Magnetic susceptibility per cell, chi = N/T (<m^2> - <|m|>^2)
+inline double susceptibility (const double* mean, double ncells, double temp) {
+  return ncells/temp*(mean[OBS_M2] - mean[OBS_M]*mean[OBS_M]);
+}
+
+// Specific heat per cell, C = N/T^2 (<e^2> - <e>^2)
+inline double specific_heat (const double* mean, double ncells, double temp) {
+  return ncells/(temp*temp)*(mean[OBS_E2] - mean[OBS_E]*mean[OBS_E]);
+}
+
+// Binder cumulant, U = 1 - <m^4>/(3 <m^2>^2) (independent of N and T, which
+// are only taken for the signature of JackknifeBins::estimate)
+inline double binder_cumulant (const double* mean, double, double) {
+  return mean[OBS_M2] > 0 ? 1.0 - mean[OBS_M4]/(3.0*mean[OBS_M2]*mean[OBS_M2]) : 0.0;
+}
+
+/*============================================================================*/
+
+/*====================\
+| Equilibrium stats |
+\====================*/
+
+// Number of standard errors by which the means of two consecutive windows
+// may differ for the run to be considered equilibrated
+const double EQUIL_SIGMAS = 2.0;
+
+// Tracks equilibration, the means, errors and autocorrelation times of the
+// moments of the magnetization and energy per cell, and the jackknife bins
+// of the derived quantities
+// Until equilibration the series is cut in windows whose length doubles
+// every time (starting at WINDOW_MIN generations). At the end of each window
+// its means of |M| and E are compared with those of the previous one: if
+// both agree within EQUIL_SIGMAS errors the run is taken as equilibrated
+// from the start of the window, whose data are kept; otherwise the window's
+// data are discarded. After equilibration all data are accumulated.
+struct EquilibriumStats {
+
+  static const int WINDOW_MIN = 64;
+
+  // Data since the start of the current window, or since equilibration
+  LogBinning magn;      // |m|
+  LogBinning magn2;     // m^2
+  LogBinning magn4;     // m^4
+  LogBinning energy;    // e
+  LogBinning energy2;   // e^2
+  JackknifeBins jack;
+
+  // Equilibrated yet, and the generation it was detected at (the start of
+  // the measurement)
+  bool equilibrated;
+  long equil_gen;
+
+  // Current window: first generation and length
+  long window_start;
+  long window;
+
+  // Means and errors of the previous window, if any
+  bool has_prev;
+  double prev_magn, prev_magn_err;
+  double prev_energy, prev_energy_err;
+
+  void reset () {
+    reset_data();
+    equilibrated = false;
+    equil_gen = -1;
+    window_start = -1;
+    window = WINDOW_MIN;
+    has_prev = false;
+    prev_magn = prev_magn_err = 0.0;
+    prev_energy = prev_energy_err = 0.0;
+  }
+
+  void reset_data () {
+    magn.reset();
+    magn2.reset();
+    magn4.reset();
+    energy.reset();
+    energy2.reset();
+    jack.reset();
+  }
+
+  // Adds the magnetization and energy per cell of generation gen
+  void add (long gen, double magn_cell, double energy_cell) {
+    double x[JackknifeBins::NUM_OBS];
+    if (window_start < 0) window_start = gen;
+    x[OBS_E] = energy_cell;
+    x[OBS_E2] = energy_cell*energy_cell;
+    x[OBS_M] = fabs(magn_cell);
+    x[OBS_M2] = magn_cell*magn_cell;
+    x[OBS_M4] = x[OBS_M2]*x[OBS_M2];
+    magn.add(x[OBS_M]);
+    magn2.add(x[OBS_M2]);
+    magn4.add(x[OBS_M4]);
+    energy.add(x[OBS_E]);
+    energy2.add(x[OBS_E2]);
+    jack.add(x);
+    if (equilibrated || magn.size() < window) return;
+    // End of window: compare with the previous one
+    if (has_prev &&
+        fabs(magn.mean() - prev_magn) <= EQUIL_SIGMAS*hypot(magn.error(), prev_magn_err) &&
+        fabs(energy.mean() - prev_energy) <= EQUIL_SIGMAS*hypot(energy.error(), prev_energy_err)) {
+      equilibrated = true;
+      equil_gen = window_start;
+      return;
+    }
+    has_prev = true;
+    prev_magn = magn.mean();
+    prev_magn_err = magn.error();
+    prev_energy = energy.mean();
+    prev_energy_err = energy.error();
+    reset_data();
+    window_start = gen+1;
+    window *= 2;
+  }
+
+  // Is <|M|> known with an error of at most target? Requires equilibration
+  // and a levelled-off error estimate.
+  bool reached (double target) const {
+    return equilibrated && magn.converged() && magn.error() <= target;
+  }
+
+  // Derived quantities of a grid of ncells cells at temperature temp, with
+  // their jackknife errors
+  void susceptibility (double ncells, double temp, double& val, double& err) const {
+    jack.estimate(::susceptibility, ncells, temp, val, err);
+  }
+
+  void specific_heat (double ncells, double temp, double& val, double& err) const {
+    jack.estimate(::specific_heat, ncells, temp, val, err);
+  }
+
+  void binder (double ncells, double temp, double& val, double& err) const {
+    jack.estimate(binder_cumulant, ncells, temp, val, err);
+  }
+
+};
+
+/*============================================================================*/
+
+#endif // BINNING_H
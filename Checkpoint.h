@@ -0,0 +1,129 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+// Binary checkpoint files, used by the models to save and restore their full
+// state (see IsingModel::saveCheckpoint and MSCIsingModel::saveCheckpoint).
+
+// A checkpoint starts with the magic "ICKP", CHECKPOINT_VERSION and a 4-byte
+// engine tag, followed by the fields of the model in the order the engine
+// writes them, as raw native-endian values. Checkpoints are only meant to be
+// read back by the same build on the same machine type.
+
+// A checkpoint is written to <fname>.tmp and renamed over fname once it is
+// complete, so an interrupted save never destroys the previous checkpoint.
+
+/*============================================================================*/
+
+// Checkpoint format version, stored in every checkpoint
+const uint32_t CHECKPOINT_VERSION = 7;
+
+/*============================================================================*/
+
+/*====================\
+| Checkpoint writer |
+\====================*/
+
+struct CheckpointWriter {
+
+  FILE* file;
+  bool ok;
+  char fname[256];
+  char tmpname[260];
+
+  // Starts writing the checkpoint for the given engine tag
+  bool open (const char* p_fname, const char* tag) {
+    uint32_t version = CHECKPOINT_VERSION;
+    snprintf(fname, sizeof(fname), "%s", p_fname);
+    snprintf(tmpname, sizeof(tmpname), "%s.tmp", fname);
+    file = fopen(tmpname, "wb");
+    ok = (file != NULL);
+    put_array("ICKP", 4);
+    put(version);
+    put_array(tag, 4);
+    return ok;
+  }
+
+  template<typename TYPE>
+  void put_array (const TYPE* data, size_t n) {
+    if (ok && n > 0) ok = (fwrite(data, sizeof(TYPE), n, file) == n);
+  }
+
+  template<typename TYPE>
+  void put (const TYPE& value) {
+    put_array(&value, 1);
+  }
+
+  // Finishes the checkpoint; returns false (leaving any previous checkpoint
+  // untouched) if anything failed
+  bool close () {
+    if (!file) return false;
+    if (fclose(file) != 0) ok = false;
+    file = NULL;
+    if (ok) ok = (rename(tmpname, fname) == 0);
+    if (!ok) remove(tmpname);
+    return ok;
+  }
+
+};
+
+/*============================================================================*/
+
+/*====================\
+| Checkpoint reader |
+\====================*/
+
+struct CheckpointReader {
+
+  FILE* file;
+  bool ok;
+
+  // Opens a checkpoint and checks its magic, version and engine tag
+  bool open (const char* fname, const char* tag) {
+    char magic[4], ftag[4];
+    uint32_t version = 0;
+    file = fopen(fname, "rb");
+    ok = (file != NULL);
+    get_array(magic, 4);
+    get(version);
+    get_array(ftag, 4);
+    if (ok && (memcmp(magic, "ICKP", 4) != 0 || version != CHECKPOINT_VERSION
+               || memcmp(ftag, tag, 4) != 0)) {
+      ok = false;
+    }
+    return ok;
+  }
+
+  template<typename TYPE>
+  void get_array (TYPE* data, size_t n) {
+    if (ok && n > 0) ok = (fread(data, sizeof(TYPE), n, file) == n);
+  }
+
+  template<typename TYPE>
+  void get (TYPE& value) {
+    get_array(&value, 1);
+  }
+
+  // Reads a value that must match the expected one
+  template<typename TYPE>
+  void expect (const TYPE& value) {
+    TYPE read;
+    get(read);
+    if (ok && read != value) ok = false;
+  }
+
+  // Closes the file; returns false if anything failed
+  bool close () {
+    if (file) fclose(file);
+    file = NULL;
+    return ok;
+  }
+
+};
+
+/*============================================================================*/
+
+#endif // CHECKPOINT_H
@@ -0,0 +1,125 @@
+#ifndef INSTRUMENT_H
+#define INSTRUMENT_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+// Optional runtime counters of IsingModel.
+
+// They are only compiled in when ISING_INSTRUMENT is defined (see
+// INSTRUMENT_FLAGS in the Makefile); otherwise IsingModel has no counters
+// and its hot paths are unchanged. They count the flips attempted and
+// accepted, by deltaE class where the sweep knows it, and the wall time
+// spent in the sweeps, in the statistics (update_stats and
+// update_sample_stats) and, as timed by the driver, in output. Together they
+// tell whether a slow run is dominated by the flips themselves, by sample
+// tracking or by output.
+
+/*============================================================================*/
+
+/*=================\
+| Runtime counters |
+\=================*/
+
+struct IsingCounters {
+
+  // Flips attempted and accepted by deltaE class, indexed by deltaE/2 + 4
+  // like IsingModel::accept_thresh (odd classes only occur next to dead
+  // cells). Counted by the serial and checkerboard sweeps.
+  static const int NUM_CLASSES = 9;
+  uint64_t class_attempts[NUM_CLASSES];
+  uint64_t class_accepts[NUM_CLASSES];
+
+  // Flips not classified by deltaE: those of the vector sweeps, and of the
+  // cluster dynamics (for Wolff, the cells tested for joining a cluster and
+  // those flipped; for Swendsen-Wang, the live cells and those flipped) and
+  // the n-fold way (the flips a sweep would attempt in the same time, and
+  // those done)
+  uint64_t bulk_attempts;
+  uint64_t bulk_accepts;
+
+  // Flips attempted and accepted in the last generation
+  uint64_t gen_attempts;
+  uint64_t gen_accepts;
+
+  // Generations counted, and wall time in seconds spent in the sweeps (or
+  // cluster updates), in the statistics and in output
+  long generations;
+  double time_sweep;
+  double time_stats;
+  double time_io;
+
+  IsingCounters () {
+    reset();
+  }
+
+  void reset () {
+    memset(class_attempts, 0, sizeof(class_attempts));
+    memset(class_accepts, 0, sizeof(class_accepts));
+    bulk_attempts = 0;
+    bulk_accepts = 0;
+    gen_attempts = 0;
+    gen_accepts = 0;
+    generations = 0;
+    time_sweep = 0.0;
+    time_stats = 0.0;
+    time_io = 0.0;
+  }
+
+  // Total flips attempted and accepted
+  uint64_t attempts () const {
+    uint64_t n = bulk_attempts;
+    for (int k = 0; k < NUM_CLASSES; k++) n += class_attempts[k];
+    return n;
+  }
+
+  uint64_t accepts () const {
+    uint64_t n = bulk_accepts;
+    for (int k = 0; k < NUM_CLASSES; k++) n += class_accepts[k];
+    return n;
+  }
+
+  // Writes a one-line summary (without newline) into buf: the share of
+  // the time in each part, the overall acceptance rate and the flips of the
+  // last generation
+  void summary_line (char* buf, int size) const {
+    double total = time_sweep + time_stats + time_io;
+    uint64_t n = attempts();
+    if (total <= 0) total = 1;
+    snprintf(buf, size, "sweep %.1f%% stats %.1f%% io %.1f%% | accept %.4f | last gen %llu/%llu",
+      100*time_sweep/total, 100*time_stats/total, 100*time_io/total,
+      n > 0 ? (double) accepts()/n : 0.0,
+      (unsigned long long) gen_accepts, (unsigned long long) gen_attempts);
+  }
+
+  // Writes a full summary into buf as '#'-prefixed lines (for the series
+  // header); returns its length
+  int summary_header (char* buf, int size) const {
+    int len, k;
+    uint64_t n = attempts();
+    len = snprintf(buf, size,
+      "# Counters: %li generations, sweep %.3f s, stats %.3f s, io %.3f s\n"
+      "# Flips attempted %llu, accepted %llu (%.4f), last generation %llu/%llu\n"
+      "# Acceptance by deltaE:",
+      generations, time_sweep, time_stats, time_io,
+      (unsigned long long) n, (unsigned long long) accepts(),
+      n > 0 ? (double) accepts()/n : 0.0,
+      (unsigned long long) gen_accepts, (unsigned long long) gen_attempts);
+    for (k = 0; k < NUM_CLASSES && len < size; k++) {
+      if (class_attempts[k] == 0) continue;
+      len += snprintf(buf + len, size - len, " %+i:%.4f", 2*(k-4),
+        (double) class_accepts[k]/class_attempts[k]);
+    }
+    if (n == bulk_attempts && len < size) {
+      len += snprintf(buf + len, size - len, " n/a (vector sweeps, cluster or n-fold way dynamics)");
+    }
+    if (len < size) len += snprintf(buf + len, size - len, "\n");
+    return len < size ? len : size-1;
+  }
+
+};
+
+/*============================================================================*/
+
+#endif // INSTRUMENT_H
@@ -1,18 +1,77 @@
 #include <stdio.h>
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 #include "IsingModel.h"
+#include "Checkpoint.h"
 #include "utils.h"
 
 /*============================================================================*/
 
+// OpenMP helpers (single-threaded fallbacks when compiled without OpenMP)
+
+static inline int thread_num () {
+#ifdef _OPENMP
+  return omp_get_thread_num();
+#else
+  return 0;
+#endif
+}
+
+static inline int max_threads () {
+#ifdef _OPENMP
+  return omp_get_max_threads();
+#else
+  return 1;
+#endif
+}
+
+/*============================================================================*/
+
+// Union-find helpers for Swendsen-Wang (see swendsenWangGeneration)
+
+// Returns the root of cell c, halving the path on the way
+static inline index_t uf_find (index_t* parent, index_t c) {
+  while (parent[c] != c) {
+    parent[c] = parent[parent[c]];
+    c = parent[c];
+  }
+  return c;
+}
+
+// Merges the clusters of cells a and b, keeping the smaller root
+static inline void uf_union (index_t* parent, index_t a, index_t b) {
+  a = uf_find(parent, a);
+  b = uf_find(parent, b);
+  if (a < b) parent[b] = a;
+  else if (b < a) parent[a] = b;
+}
+
+/*============================================================================*/
+
 /*==================================\\
 || Ising Model class implementation ||
 \\==================================*/
 
 /*============================================================================*/
 
+// Allocates a padded lattice of LATTICE_SIZE cells of the given type
+// The array is aligned to LATTICE_ALIGN bytes and zero-initialized.
+template<typename TYPE>
+static TYPE* alloc_lattice (index_t size) {
+  size_t bytes = size*sizeof(TYPE);
+  bytes = (bytes + LATTICE_ALIGN - 1)/LATTICE_ALIGN*LATTICE_ALIGN;
+  TYPE* lat = (TYPE*) aligned_alloc(LATTICE_ALIGN, bytes);
+  memset(lat, 0, bytes);
+  return lat;
+}
+
+/*============================================================================*/
+
 // CONSTRUCTORS
 
 // Basic constructor
@@ -23,7 +82,9 @@ IsingModel::IsingModel (int p_NGRID, double p_TEMP) {
   // Set model parameters
   TEMP = p_TEMP;
   NGRID = p_NGRID;
-  NCELLS = NGRID*NGRID;
+  NCELLS = (index_t) NGRID*NGRID;
+  STRIDE = NGRID+2;
+  LATTICE_SIZE = (index_t) STRIDE*STRIDE;
   NUM_SAMPLES = 0;
   SAMPLE_MIN = 0;
   SAMPLE_MAX = 0;
@@ -36,6 +97,9 @@ IsingModel::IsingModel (int p_NGRID, double p_TEMP) {
   sample_npts = NULL;
   sample_size = NULL;
   sample_cells = NULL;
+  cell_sample_start = NULL;
+  cell_samples = NULL;
+  rundata = NULL;
   track_samples = false;
 
   // Do common tasks
@@ -50,11 +114,14 @@ IsingModel::IsingModel (int p_NGRID, double p_TEMP) {
 IsingModel::IsingModel (int p_NGRID, double p_TEMP, int p_NUM_SAMPLES, int p_SAMPLE_MIN, int p_SAMPLE_MAX, int p_START_GEN, int p_NUM_DATA) {
 
   double a;
+  int total;
 
   // Set model parameters
   TEMP = p_TEMP;
   NGRID = p_NGRID;
-  NCELLS = NGRID*NGRID;
+  NCELLS = (index_t) NGRID*NGRID;
+  STRIDE = NGRID+2;
+  LATTICE_SIZE = (index_t) STRIDE*STRIDE;
   NUM_SAMPLES = p_NUM_SAMPLES;
   SAMPLE_MIN = p_SAMPLE_MIN;
   SAMPLE_MAX = p_SAMPLE_MAX;
@@ -71,22 +138,28 @@ IsingModel::IsingModel (int p_NGRID, double p_TEMP, int p_NUM_SAMPLES, int p_SAM
 
   // Determine sample sizes and allocate sample cell lists
   sample_size = (int*) malloc(NUM_SAMPLES*sizeof(int));
-  sample_cells = (int**) malloc(NUM_SAMPLES*sizeof(int*));
+  sample_cells = (index_t**) malloc(NUM_SAMPLES*sizeof(index_t*));
   a = pow((double)SAMPLE_MAX/SAMPLE_MIN, 1.0/(NUM_SAMPLES-1));
+  total = 0;
   for (int s = 0; s < NUM_SAMPLES; s++) {
     sample_size[s] = round(SAMPLE_MIN*pow(a,s));
-    sample_cells[s] = (int*) malloc(sample_size[s]*sizeof(int));
+    sample_cells[s] = (index_t*) malloc(sample_size[s]*sizeof(index_t));
+    total += sample_size[s];
   }
 
-  // Randomly pick cells to be sampled
-  pickSamples();
+  // Allocate per-cell sample membership index (filled by pickSamples)
+  cell_sample_start = (int*) malloc((NCELLS+1)*sizeof(int));
+  cell_samples = (int*) malloc(total*sizeof(int));
 
   // Allocate running mean array
-  rundata = (double*) malloc(NUM_SAMPLES*sizeof(double));
+  rundata = (double*) malloc(NUM_DATA*sizeof(double));
 
   // Do common tasks
   common_constructor();
 
+  // Randomly pick cells to be sampled (once the RNG is seeded)
+  pickSamples();
+
 }
 
 /*============================================================================*/
@@ -95,42 +168,110 @@ IsingModel::IsingModel (int p_NGRID, double p_TEMP, int p_NUM_SAMPLES, int p_SAM
 
 void IsingModel::common_constructor () {
 
-  int i;
+  // Power of two grid sizes get shift/mask cell coordinates (see cell_coords)
+  NGRID_SHIFT = -1;
+  for (int k = 0; (1 << k) <= NGRID; k++) {
+    if ((1 << k) == NGRID) NGRID_SHIFT = k;
+  }
 
   // Default flip strategy. User must change after class instantiation.
   flip_strategy = STRATEGY_SHUFFLE;
 
   // Default dynamics. User must change after class instantiation
   trans_dynamics = DYNAMICS_METROPOLIS;
+  update_acceptance();
 
   // Allocate spin grid (initialize grid_copy to null ptr)
-  grid = (int**) malloc(NGRID*sizeof(int*));
-  for (i = 0; i < NGRID; i++) {
-    grid[i] = (int*) malloc(NGRID*sizeof(int));
-  }
+  grid = alloc_lattice<spin_t>(LATTICE_SIZE);
   grid_copy = NULL;
+  cluster_stack = NULL;
+  cluster_parent = NULL;
+
+  // The n-fold way index is allocated and built when first needed
+  nfold_cells = NULL;
+  nfold_pos = NULL;
+  nfold_class = NULL;
+  nfold_valid = false;
+  nfold_step = 1.0;
+
+  // Per-thread RNG streams are allocated when first needed
+  thread_rng = NULL;
+  num_thread_rng = 0;
+
+  // Vector kernel: detect instruction set (RNG states allocated when needed)
+  simd_isa = detect_simd();
+  simd_rng = NULL;
+  num_simd_rng = 0;
 
   // Dead cells -- turned OFF by default
   dead_cells = NULL;
   useDeadCells = false;
-
-  // Allocate and initialize flip_order
-  flip_order = (int*) malloc(NCELLS*sizeof(int));
-  for (i = 0; i < NCELLS; i++) {
-    flip_order[i] = i;
-  }
+  DEAD_DENS = 0.0;
+
+  // All cells start live, so the live cell lists aren't needed yet
+  live_cells = NULL;
+  color_cells = NULL;
+  color_start = (index_t*) malloc((2*NGRID+1)*sizeof(index_t));
+  flip_order = NULL;
+  tile_cells = NULL;
+  tile_start = NULL;
+  tile_row = NULL;
+  tile_col = NULL;
+  num_tiles = 0;
+  update_live_cells();
 
   // Reset all stats
   reset_stats();
   cur_gen = 0;
 
-  // Seed RNG
-  srand(time(NULL));
+  // Seed RNG (the user may reseed with setSeed)
+  seed = time(NULL);
+  rng.seed(seed, 0);
 
 }
 
 /*============================================================================*/
 
+// Destructor
+// Frees all arrays owned by the model.
+IsingModel::~IsingModel () {
+  free(grid);
+  free(grid_copy);
+  free(cluster_stack);
+  free(cluster_parent);
+  free(nfold_cells);
+  free(nfold_pos);
+  free(nfold_class);
+  free(dead_cells);
+  free(live_cells);
+  free(color_cells);
+  free(color_start);
+  free(flip_order);
+  free(tile_cells);
+  free(tile_start);
+  free(tile_row);
+  free(tile_col);
+  free(thread_rng);
+  free(simd_rng);
+  if (track_samples) {
+    for (int s = 0; s < NUM_SAMPLES; s++) {
+      free(sample_cells[s]);
+    }
+    free(sample_cells);
+    free(sample_size);
+    free(cell_sample_start);
+    free(cell_samples);
+    free(sample_magn);
+    free(sample_mean);
+    free(sample_var);
+    free(sample_M2);
+    free(sample_npts);
+    free(rundata);
+  }
+}
+
+/*============================================================================*/
+
 // Reset all stats
 void IsingModel::reset_stats () {
   global_energy = 0;
@@ -138,6 +279,7 @@ void IsingModel::reset_stats () {
   global_mean = 0.0;
   global_variance = 0.0;
   global_npoints = 0;
+  equil.reset();
   global_M2 = 0;
   if (track_samples) {
     for (int s = 0; s < NUM_SAMPLES; s++) {
@@ -150,29 +292,37 @@ void IsingModel::reset_stats () {
   run_mean = 0.0;
   run_var = 0.0;
   nextdata = 0;
+#ifdef ISING_INSTRUMENT
+  counters.reset();
+#endif
 }
 
 /*============================================================================*/
 
-// Computes the current global magnetization of the grid
+// Computes the current global energy of the grid
+// The sum of the cell energies counts every bond twice, so it is halved to
+// match the energy changes accumulated by tryCellFlip.
 void IsingModel::update_energy () {
-  global_energy = 0;
+  int64_t sum = 0;
   for (int i = 0; i < NGRID; i++) {
     for (int j = 0; j < NGRID; j++) {
-      global_energy += compute_energy_cell(i, j, false);
+      sum += compute_energy_site(site(i,j), grid);
     }
   }
+  global_energy = sum/2;
 }
 
 /*============================================================================*/
 
 // Computes the current global magnetization of the grid
 void IsingModel::update_magnetization () {
-  int i, j, sum;
+  int i, j;
+  int64_t sum;
   sum = 0;
   for (i = 0; i < NGRID; i++) {
+    spin_t* row = &grid[site(i,0)];
     for (j = 0; j < NGRID; j++) {
-      sum += grid[i][j];
+      sum += row[j];
     }
   }
   global_magnetization = sum/(double)(NCELLS);
@@ -186,7 +336,7 @@ void IsingModel::update_sample_magn (int sample) {
   sum = 0;
   for (i = 0; i < sample_size[sample]; i++) {
     getCellCoords(sample_cells[sample][i], x, y);
-    sum += grid[x][y];
+    sum += get_spin(x,y);
   }
   sample_magn[sample] = sum/(double)(sample_size[sample]);
 }
@@ -198,13 +348,16 @@ void IsingModel::randomize () {
   int i, j, s;
   for (i = 0; i < NGRID; i++) {
     for (j = 0; j < NGRID; j++) {
-      if (rand()%2 == 0){
-        grid[i][j] = -1;
+      if (rng.next_u32() & 1){
+        grid[site(i,j)] = -1;
       } else {
-        grid[i][j] = +1;
+        grid[site(i,j)] = +1;
       }
     }
   }
+  sync_halo(grid);
+  clear_dead_spins();
+  nfold_valid = false;
   update_magnetization();
   for (s = 0; s < NUM_SAMPLES; s++) {
     update_sample_magn(s);
@@ -221,13 +374,16 @@ void IsingModel::set_magnetization (double magn) {
   double p = (magn+1)/2.0;
   for (i = 0; i < NGRID; i++) {
     for (j = 0; j < NGRID; j++) {
-      if (rand()/(double)RAND_MAX<=p){
-        grid[i][j] = +1;
+      if (rng.uniform() < p){
+        grid[site(i,j)] = +1;
       } else {
-        grid[i][j] = -1;
+        grid[site(i,j)] = -1;
       }
     }
   }
+  sync_halo(grid);
+  clear_dead_spins();
+  nfold_valid = false;
   update_magnetization();
   for (s = 0; s < NUM_SAMPLES; s++) {
     update_sample_magn(s);
@@ -241,10 +397,12 @@ void IsingModel::display () {
   int i, j;
   for (i = 0; i < NGRID; i++) {
     for (j = 0; j < NGRID; j++) {
-      if (grid[i][j]==+1) {
+      if (get_spin(i,j)==+1) {
         printf("+");
-      } else {
+      } else if (get_spin(i,j)==-1) {
         printf("-");
+      } else {
+        printf(".");
       }
       if (j<(NGRID-1)) printf(" ");
     }
@@ -256,27 +414,19 @@ void IsingModel::display () {
 
 // Activates dead cells
 // This will allocate the dead_cells array (if not already allocated) and
-// turn on the useDeadCells flag
+// turn on the useDeadCells flag. All cells start live.
 void IsingModel::activateDeadCells() {
 
-  int i, j;
-
   // Allocate dead_cells array if not allocated
   if (!dead_cells) {
-    dead_cells = (bool**) malloc(NGRID*sizeof(bool*));
-    for (i = 0; i < NGRID; i++) {
-      dead_cells[i] = (bool*) malloc(NGRID*sizeof(bool));
-    }
+    dead_cells = alloc_lattice<bool>(LATTICE_SIZE);
   }
 
   // Initialize to all false
-  for (i = 0; i < NGRID; i++) {
-    for (j = 0; j < NGRID; j++) {
-       dead_cells[i][j] = false;
-    }
-  }
+  memset(dead_cells, 0, LATTICE_SIZE*sizeof(bool));
 
   useDeadCells = true;
+  update_dead_cells();
 
 }
 
@@ -290,73 +440,383 @@ void IsingModel::randomizeDead(double density) {
   int i, j;
   for (i = 0; i < NGRID; i++) {
     for (j = 0; j < NGRID; j++) {
-      if (rand()/(double)RAND_MAX <= density){
-        dead_cells[i][j] = true;
+      if (rng.uniform() < density){
+        dead_cells[site(i,j)] = true;
       } else {
-        dead_cells[i][j] = false;
+        dead_cells[site(i,j)] = false;
+      }
+    }
+  }
+  DEAD_DENS = density;
+  update_dead_cells();
+
+}
+
+/*============================================================================*/
+
+// Applies changes made to dead_cells (e.g. after copying it from another
+// model): rebuilds the live cell lists and recomputes the energy and
+// magnetization of the grid
+void IsingModel::update_dead_cells () {
+  int s;
+  sync_halo(dead_cells);
+  update_live_cells();
+  update_energy();
+  update_magnetization();
+  for (s = 0; s < NUM_SAMPLES; s++) {
+    update_sample_magn(s);
+  }
+}
+
+/*============================================================================*/
+
+// Rebuilds the lists of live cells (live_cells, the checkerboard
+// color_cells and, if allocated, flip_order and tile_cells) and NLIVE from
+// dead_cells, sets the spin of the dead cells to 0, and gives spin +1 to any
+// live cell left at 0 (e.g. a cell revived by activateDeadCells). Leaves the
+// grid untouched if it is already consistent.
+void IsingModel::update_live_cells () {
+
+  int i, j, c;
+  index_t k;
+
+  clear_dead_spins();
+  nfold_valid = false;
+  for (i = 0; i < NGRID; i++) {
+    for (j = 0; j < NGRID; j++) {
+      if (grid[site(i,j)] == 0 && !(useDeadCells && dead_cells[site(i,j)])) {
+        set_spin(i, j, +1);
+      }
+    }
+  }
+
+  // The lists are only kept if there are dead cells (see live_cell)
+  if (useDeadCells) {
+    if (!live_cells) {
+      live_cells = (index_t*) malloc(NCELLS*sizeof(index_t));
+      color_cells = (int*) malloc(NCELLS*sizeof(int));
+    }
+  } else {
+    free(live_cells);
+    free(color_cells);
+    live_cells = NULL;
+    color_cells = NULL;
+  }
+
+  // Live cells in row-major order
+  NLIVE = 0;
+  for (i = 0; i < NGRID; i++) {
+    for (j = 0; j < NGRID; j++) {
+      if (grid[site(i,j)] != 0) {
+        if (live_cells) getCellID(i, j, live_cells[NLIVE]);
+        NLIVE++;
+      }
+    }
+  }
+
+  // Live cells of each color, row by row
+  k = 0;
+  for (i = 0; i < NGRID; i++) {
+    for (c = 0; c < 2; c++) {
+      color_start[2*i+c] = k;
+      for (j = (i+c)%2; j < NGRID; j += 2) {
+        if (grid[site(i,j)] != 0) {
+          if (color_cells) color_cells[k] = j;
+          k++;
+        }
+      }
+    }
+  }
+  color_start[2*NGRID] = k;
+
+  // Flip order, and live cells of each tile
+  if (flip_order) update_flip_order();
+  if (tile_cells) update_tile_cells();
+
+}
+
+/*============================================================================*/
+
+// Resets flip_order (allocating it if not allocated) to the live cell IDs in
+// increasing order
+void IsingModel::update_flip_order () {
+
+  int i, j;
+  index_t ID, k;
+
+  if (!flip_order) {
+    flip_order = (uint32_t*) malloc(NCELLS*sizeof(uint32_t));
+  }
+  k = 0;
+  for (ID = 0; ID < NCELLS; ID++) {
+    getCellCoords(ID, i, j);
+    if (grid[site(i,j)] != 0) flip_order[k++] = ID;
+  }
+
+}
+
+/*============================================================================*/
+
+// Builds tile_cells (allocating it if not allocated): the live cells of each
+// TILE_SIZE x TILE_SIZE tile, row by row, with the tiles in Morton order
+// Tile (tx,ty) has the Morton code that interleaves the bits of tx and ty;
+// the codes are walked up to the next power of two of tiles per side, so
+// that grids that aren't a multiple of TILE_SIZE (or whose number of tiles
+// isn't a power of two) get their edge tiles in the same order, just
+// smaller.
+void IsingModel::update_tile_cells () {
+
+  int ntiles, side, code, tx, ty, b, i, j, t;
+  index_t k;
+
+  ntiles = (NGRID + TILE_SIZE - 1)/TILE_SIZE;
+  if (!tile_cells) {
+    tile_cells = (uint16_t*) malloc(NCELLS*sizeof(uint16_t));
+    tile_start = (index_t*) malloc((ntiles*ntiles+1)*sizeof(index_t));
+    tile_row = (int*) malloc(ntiles*ntiles*sizeof(int));
+    tile_col = (int*) malloc(ntiles*ntiles*sizeof(int));
+  }
+  num_tiles = ntiles*ntiles;
+  side = 1;
+  while (side < ntiles) side *= 2;
+
+  k = 0;
+  t = 0;
+  for (code = 0; code < side*side; code++) {
+    tx = 0;
+    ty = 0;
+    for (b = 0; (1 << b) < side; b++) {
+      tx |= ((code >> (2*b)) & 1) << b;
+      ty |= ((code >> (2*b+1)) & 1) << b;
+    }
+    if (tx >= ntiles || ty >= ntiles) continue;
+    tile_row[t] = ty*TILE_SIZE;
+    tile_col[t] = tx*TILE_SIZE;
+    tile_start[t++] = k;
+    for (i = ty*TILE_SIZE; i < (ty+1)*TILE_SIZE && i < NGRID; i++) {
+      for (j = tx*TILE_SIZE; j < (tx+1)*TILE_SIZE && j < NGRID; j++) {
+        if (grid[site(i,j)] != 0) {
+          tile_cells[k++] = (i - ty*TILE_SIZE)*TILE_SIZE + (j - tx*TILE_SIZE);
+        }
       }
     }
   }
+  tile_start[t] = k;
 
 }
+
+/*============================================================================*/
+
+// Sets the spin of every dead cell (halo images included) to 0
+void IsingModel::clear_dead_spins () {
+  if (!useDeadCells) return;
+  for (index_t idx = 0; idx < LATTICE_SIZE; idx++) {
+    if (dead_cells[idx]) grid[idx] = 0;
+  }
+}
+
 /*============================================================================*/
 
 // Advances the grid by one "generation"
 // One generation is defined as having attempted a flip for *all* cells.
 // The order in which the cells are temptatively flipped depends on the
 // defined flip strategy, which is one of the following:
-// STRATEGY_RANDOM: flips are done completely at random, stopping after NCELLS
+// STRATEGY_RANDOM: flips are done completely at random, stopping after NLIVE
 //                  flips have been attempted.
 // STRATEGY_SHUFFLED: before each generation, the order of the flips is shuffled
-//                    (by means of the Fisher-Yates shuffle).
+//                    (by means of the Fisher-Yates shuffle). Grids of more
+//                    than SHUFFLE_ARRAY_MAX cells follow a new
+//                    FeistelPermutation of the live cells instead, computed
+//                    on the fly rather than stored.
 // STRATEGY_SEQUENTIAL: the flips are done sequentially from left to right and
 //                      from top to bottom
 // STRATEGY_PEANO: does a sequential flip following two converging Peano-like
 //                 curves to try to minimize direction bias
 // STRATEGY_COPY: the grid is copied, and the flips are done sequentially but
 //                using the copied grid for neighbor information.
-// Note that in all strategies except the last no copy of the grid is made,
-// so later flips may depend on the results of previous ones.
+// STRATEGY_CHECKERBOARD: the grid is colored like a checkerboard, and all
+//                        "black" cells are flipped, then all "white" ones.
+//                        Each half-sweep is split across OpenMP threads.
+// STRATEGY_SIMD: same as STRATEGY_CHECKERBOARD, but using AVX2/AVX-512 vector
+//                kernels when the CPU supports them (see simdSweep).
+// STRATEGY_TILED: the grid is split in TILE_SIZE x TILE_SIZE tiles, which are
+//                 visited in Morton order, and the cells of each tile are
+//                 shuffled like in STRATEGY_SHUFFLE. Random order within
+//                 the tiles, but each tile stays in cache while it is swept,
+//                 so for grids larger than the cache it is much faster.
+// Note that in all strategies except STRATEGY_COPY no copy of the grid is
+// made, so later flips may depend on the results of previous ones.
+// Dead cells are never visited (except by the vector kernels, where they
+// are just lanes that can't change).
+// With DYNAMICS_WOLFF or DYNAMICS_SWENDSEN_WANG the flip strategy is ignored,
+// and a generation is instead made of cluster flips (see wolffGeneration and
+// swendsenWangGeneration). DYNAMICS_NFOLD ignores it too, and advances the
+// continuous-time clock by nfold_step sweeps instead (see nfoldGeneration).
 void IsingModel::doGeneration () {
 
-  int i, j, x, y, tmp;
-  int i1, j1, i2, j2, count, next, d1, d2;
+  // Rebuild the acceptance table if TEMP or trans_dynamics were modified
+  // directly since it was last built
+  if (TEMP != table_temp || trans_dynamics != table_dynamics) {
+    update_acceptance();
+  }
+
+#ifdef ISING_INSTRUMENT
+  double t0 = wall_time(), t1;
+  uint64_t attempts0 = counters.attempts(), accepts0 = counters.accepts();
+#endif
+
+  // Cluster dynamics don't use a flip strategy
+  if (trans_dynamics == DYNAMICS_WOLFF) {
+    wolffGeneration();
+  } else if (trans_dynamics == DYNAMICS_SWENDSEN_WANG) {
+    swendsenWangGeneration();
+  } else if (trans_dynamics == DYNAMICS_NFOLD) {
+    nfoldGeneration();
+  } else {
+    sweep();
+  }
+
+  // Other dynamics don't keep the n-fold way index up to date
+  if (trans_dynamics != DYNAMICS_NFOLD) nfold_valid = false;
+
+#ifdef ISING_INSTRUMENT
+  t1 = wall_time();
+  counters.time_sweep += t1 - t0;
+#endif
+
+  // Update stats (and sample stats, if applicable)
+  cur_gen++;
+  if (cur_gen>=START_GEN) {
+    update_stats();
+    if (track_samples) update_sample_stats();
+  }
+
+#ifdef ISING_INSTRUMENT
+  counters.time_stats += wall_time() - t1;
+  counters.gen_attempts = counters.attempts() - attempts0;
+  counters.gen_accepts = counters.accepts() - accepts0;
+  counters.generations++;
+#endif
+
+}
+
+/*============================================================================*/
+
+// Attempts one flip per cell, in the order given by flip_strategy
+// (see doGeneration)
+// The serial strategies run a sweepKernel specialized at compile time for
+// whether sample magnetizations are tracked and whether NGRID is a power of
+// two. The specialization is picked here, once per generation, so the loop
+// over the cells has no tests on the settings left.
+void IsingModel::sweep () {
+
+  bool pow2 = (NGRID_SHIFT >= 0);
+
+  switch (flip_strategy) {
+
+  case STRATEGY_CHECKERBOARD:
+
+    checkerboardSweep();
+    break;
+
+  case STRATEGY_SIMD:
+
+    simdSweep();
+    break;
+
+  default:
+
+    if (track_samples) {
+      if (pow2) sweepKernel<true,true>();
+      else sweepKernel<true,false>();
+    } else {
+      if (pow2) sweepKernel<false,true>();
+      else sweepKernel<false,false>();
+    }
+    break;
+
+  }
+
+}
+
+/*============================================================================*/
+
+// Serial sweep for the strategies other than STRATEGY_CHECKERBOARD and
+// STRATEGY_SIMD (see sweep)
+template<bool TRACK_SAMPLES, bool POW2>
+void IsingModel::sweepKernel () {
+
+  int x, y, tmp;
+  int i1, j1, i2, j2, next, d1, d2;
+  int t;
+  index_t i, k, count, first;
+  uint32_t ID;
+  FeistelPermutation perm;
 
   switch (flip_strategy) {
 
   case STRATEGY_SHUFFLE:
 
-    // Shuffle flip order
-    for (i = 0; i < NCELLS; i++) {
-      x = rand() % (NCELLS-i) + i;
-      tmp = flip_order[i];
-      flip_order[i] = flip_order[x];
-      flip_order[x] = tmp;
+    if (NCELLS <= SHUFFLE_ARRAY_MAX) {
+      // Shuffle flip order (built if not built)
+      if (!flip_order) update_flip_order();
+      for (i = 0; i < NLIVE; i++) {
+        k = rng.below(NLIVE-i) + i;
+        ID = flip_order[i];
+        flip_order[i] = flip_order[k];
+        flip_order[k] = ID;
+      }
+      // Attempt flip for all live cells
+      for (i = 0; i < NLIVE; i++) {
+        cell_coords<POW2>(flip_order[i], x, y);
+        tryCellFlipKernel<false,TRACK_SAMPLES>(x,y);
+      }
+    } else {
+      // Attempt flip for all live cells, in a fresh pseudorandom order
+      perm.init(NLIVE, rng.next_u64());
+      for (i = 0; i < NLIVE; i++) {
+        live_coords<POW2>(perm(i), x, y);
+        tryCellFlipKernel<false,TRACK_SAMPLES>(x,y);
+      }
     }
-    // Attempt flip for all cells
-    for (i = 0; i < NCELLS; i++) {
-      getCellCoords(flip_order[i], x, y);
-      tryCellFlip(x,y,false);
+    break;
+
+  case STRATEGY_TILED:
+
+    // Build the tile lists if not built
+    if (!tile_cells) update_tile_cells();
+    // Shuffle each tile and attempt flip for its live cells, tile by tile
+    for (t = 0; t < num_tiles; t++) {
+      first = tile_start[t];
+      count = tile_start[t+1] - first;
+      for (i = 0; i < count; i++) {
+        k = rng.below(count-i) + i;
+        tmp = tile_cells[first+i];
+        tile_cells[first+i] = tile_cells[first+k];
+        tile_cells[first+k] = tmp;
+      }
+      for (i = 0; i < count; i++) {
+        tmp = tile_cells[first+i];
+        tryCellFlipKernel<false,TRACK_SAMPLES>(tile_row[t] + tmp/TILE_SIZE, tile_col[t] + tmp%TILE_SIZE);
+      }
     }
     break;
 
   case STRATEGY_RANDOM:
 
-    // Completely random flips. Stops after NCELLS flips.
-    for (tmp = 1; tmp <= NCELLS; tmp++) {
-      i = rand() % NGRID;
-      j = rand() % NGRID;
-      tryCellFlip(i,j,false);
+    // Completely random flips of live cells. Stops after NLIVE flips.
+    for (i = 1; i <= NLIVE; i++) {
+      live_coords<POW2>(rng.below(NLIVE), x, y);
+      tryCellFlipKernel<false,TRACK_SAMPLES>(x,y);
     }
     break;
 
   case STRATEGY_SEQUENTIAL:
 
     // Do flips in sequential (index) order
-    for (i = 0; i < NGRID; i++) {
-      for (j = 0; j < NGRID; j++) {
-        tryCellFlip(i,j,false);
-      }
+    for (i = 0; i < NLIVE; i++) {
+      live_coords<POW2>(i, x, y);
+      tryCellFlipKernel<false,TRACK_SAMPLES>(x,y);
     }
     break;
 
@@ -382,7 +842,7 @@ void IsingModel::doGeneration () {
         } else {
           i1 += d1;
         }
-        tryCellFlip(i1,j1,false);
+        if (get_spin(i1,j1) != 0) tryCellFlipKernel<false,TRACK_SAMPLES>(i1,j1);
         next = 1;
       } else if (next == 1) {
         if ((d2 == +1 && i2 == NGRID-1) || (d2 == -1 && i2 == 0)){
@@ -391,7 +851,7 @@ void IsingModel::doGeneration () {
         } else {
           i2 += d2;
         }
-        tryCellFlip(i2,j2,false);
+        if (get_spin(i2,j2) != 0) tryCellFlipKernel<false,TRACK_SAMPLES>(i2,j2);
         next = 0;
       }
       count++;
@@ -407,34 +867,102 @@ void IsingModel::doGeneration () {
 
     // Allocate grid_copy array if not allocated
     if (!grid_copy) {
-      grid_copy = (int**) malloc(NGRID*sizeof(int*));
-      for (i = 0; i < NGRID; i++) {
-        grid_copy[i] = (int*) malloc(NGRID*sizeof(int));
-      }
+      grid_copy = alloc_lattice<spin_t>(LATTICE_SIZE);
     }
 
-    // Copy grid
-    for (i = 0; i < NGRID; i++) {
-      for (j = 0; j < NGRID; j++) {
-        grid_copy[i][j] = grid[i][j];
-      }
-    }
+    // Copy grid (halo included)
+    memcpy(grid_copy, grid, LATTICE_SIZE*sizeof(spin_t));
 
     // Do flips (energy computed using grid copy)
-    for (i = 0; i < NGRID; i++) {
-      for (j = 0; j < NGRID; j++) {
-        tryCellFlip(i,j,true);
-      }
+    for (i = 0; i < NLIVE; i++) {
+      live_coords<POW2>(i, x, y);
+      tryCellFlipKernel<true,TRACK_SAMPLES>(x,y);
     }
+
+    // The energy changes accumulated above were measured against the copy,
+    // so they don't add up to the change of the actual grid: recompute it
+    update_energy();
     break;
 
   }
 
-  // Update stats (and sample stats, if applicable)
-  cur_gen++;
-  if (cur_gen>=START_GEN) {
-    update_stats();
-    if (track_samples) update_sample_stats();
+}
+
+/*============================================================================*/
+
+// Does a checkerboard (red/black) sweep of the grid
+// Cells of the same color are never neighbors, so all cells of one color can
+// be updated simultaneously without altering the dynamics: each half-sweep is
+// distributed among threads, each with its own RNG stream, and the energy
+// and magnetization changes are combined with a reduction. If NGRID is odd
+// the coloring doesn't wrap around consistently and the sweep runs serially.
+// Every row draws all its random numbers at once, and one is used per live
+// cell of the color (certain flips have a threshold no uniform can exceed).
+// Only live cells are visited, through the color_cells lists if there are
+// dead cells.
+void IsingModel::checkerboardSweep () {
+
+  int color, s;
+  int64_t dE, dM;
+
+  init_thread_rng();
+
+  dE = 0;
+  dM = 0;
+  for (color = 0; color < 2; color++) {
+    #pragma omp parallel reduction(+:dE,dM) if(NGRID%2 == 0)
+    {
+      IsingRNG* trng = &thread_rng[thread_num()];
+      uint32_t* ubuf = (uint32_t*) malloc((NGRID/2+1)*sizeof(uint32_t));
+      int i, j, k, count, deltaE, spin;
+      index_t first;
+#ifdef ISING_INSTRUMENT
+      // Per-thread counts, added to the counters at the end
+      uint64_t attempts[NUM_DELTAE] = {0}, accepts[NUM_DELTAE] = {0};
+#endif
+      #pragma omp for schedule(static)
+      for (i = 0; i < NGRID; i++) {
+        first = color_start[2*i+color];
+        count = color_start[2*i+color+1] - first;
+        trng->fill_u31(ubuf, count);
+        for (k = 0; k < count; k++) {
+          j = color_cells ? color_cells[first+k] : (i+color)%2 + 2*k;
+          deltaE = -2*compute_energy_site(site(i,j), grid);
+#ifdef ISING_INSTRUMENT
+          attempts[deltaE/2 + 4]++;
+#endif
+          if ((int32_t) ubuf[k] <= simd_thresh[deltaE/2 + 4]) {
+#ifdef ISING_INSTRUMENT
+            accepts[deltaE/2 + 4]++;
+#endif
+            spin = -get_spin(i,j);
+            set_spin(i, j, spin);
+            dE += deltaE;
+            dM += 2*spin;
+          }
+        }
+      }
+      free(ubuf);
+#ifdef ISING_INSTRUMENT
+      for (k = 0; k < NUM_DELTAE; k++) {
+        #pragma omp atomic
+        counters.class_attempts[k] += attempts[k];
+        #pragma omp atomic
+        counters.class_accepts[k] += accepts[k];
+      }
+#endif
+    }
+  }
+
+  // Update global energy and magnetization
+  global_energy += dE;
+  global_magnetization += dM/(double)(NCELLS);
+
+  // Recompute sample magnetizations, rather than tracking them per flip
+  if (track_samples) {
+    for (s = 0; s < NUM_SAMPLES; s++) {
+      update_sample_magn(s);
+    }
   }
 
 }
@@ -447,120 +975,798 @@ void IsingModel::doGeneration () {
 // the current state of the grid or from a copy of the previous generation's
 // grid.
 int IsingModel::compute_energy_cell (int i, int j, bool from_copy) {
+  return compute_energy_site(site(i,j), from_copy ? grid_copy : grid);
+}
 
-  int ip, im, jp, jm;
-  int energy, neigh_sum;
-  int** _grid;
-
-  ip = i+1;
-  im = i-1;
-  jp = j+1;
-  jm = j-1;
-  if      (i == 0) im = NGRID-1;
-  else if (i == NGRID-1) ip = 0;
-  if      (j == 0) jm = NGRID-1;
-  else if (j == NGRID-1) jp = 0;
+/*============================================================================*/
 
+// Attempts to flip cell (i,j)
+// This will compute the change in energy the flip would produce and accept
+// it with the probability given by the transition dynamics, as tabulated by
+// update_acceptance().
+// The from_copy boolean determines if the neighbor information is pulled from
+// the current state of the grid or from a copy of the previous generation's
+// grid.
+// Calls the tryCellFlipKernel matching from_copy and track_samples.
+void IsingModel::tryCellFlip (int i, int j, bool from_copy) {
   if (from_copy) {
-    _grid = grid_copy;
+    if (track_samples) tryCellFlipKernel<true,true>(i, j);
+    else tryCellFlipKernel<true,false>(i, j);
   } else {
-    _grid = grid;
+    if (track_samples) tryCellFlipKernel<false,true>(i, j);
+    else tryCellFlipKernel<false,false>(i, j);
+  }
+}
+
+/*============================================================================*/
+
+// tryCellFlip, specialized at compile time on where the neighbor spins are
+// read from and whether sample magnetizations are tracked
+template<bool FROM_COPY, bool TRACK_SAMPLES>
+inline void IsingModel::tryCellFlipKernel (int i, int j) {
+
+  int deltaE, thresh;
+
+  // Always true since E_i = s_i*(sum_neighs s_n)
+  deltaE = -2*compute_energy_site(site(i,j), FROM_COPY ? grid_copy : grid);
+#ifdef ISING_INSTRUMENT
+  counters.class_attempts[deltaE/2 + 4]++;
+#endif
+
+  // Roll the "die" (only if the flip is not certain)
+  thresh = accept_thresh[deltaE/2 + 4];
+  if (thresh == ACCEPT_ALWAYS || (int) rng.next_u31() <= thresh) {
+#ifdef ISING_INSTRUMENT
+    counters.class_accepts[deltaE/2 + 4]++;
+#endif
+    flipCellKernel<TRACK_SAMPLES>(i, j, deltaE);
   }
 
-  neigh_sum = 0;
-  if (!useDeadCells || !dead_cells[ip][j])
-    neigh_sum += _grid[ip][j];
-  if (!useDeadCells || !dead_cells[im][j])
-    neigh_sum += _grid[im][j];
-  if (!useDeadCells || !dead_cells[i][jp])
-    neigh_sum += _grid[i][jp];
-  if (!useDeadCells || !dead_cells[i][jm])
-    neigh_sum += _grid[i][jm];
-  energy = -_grid[i][j] * neigh_sum;
-  
-  return energy;
+}
+
+/*============================================================================*/
 
+// Flips cell (i,j), whose flip changes the energy by deltaE, and updates the
+// global energy and magnetization (and sample magnetizations, if tracked)
+void IsingModel::flipCell (int i, int j, int deltaE) {
+  if (track_samples) flipCellKernel<true>(i, j, deltaE);
+  else flipCellKernel<false>(i, j, deltaE);
 }
 
 /*============================================================================*/
 
-// Attempts to flip cell (i,j)
-// This will compute the change in energy the flip would produce
-// and then apply the Metropolis algorithm:
-// 1) if the new energy is lower or unchanged, always flip
-// 2) if the new energy is higher, flip with probability e^(-deltaE/T)
-// The from_copy boolean determines if the neighbor information is pulled from
-// the current state of the grid or from a copy of the previous generation's
-// grid.
-void IsingModel::tryCellFlip (int i, int j, bool from_copy) {
+// flipCell, specialized at compile time on whether sample magnetizations
+// are tracked
+template<bool TRACK_SAMPLES>
+inline void IsingModel::flipCellKernel (int i, int j, int deltaE) {
 
-  int old_E, new_E, deltaE;
-  int ID, s;
-  double prob;
-  bool do_flip;
-  int ip, im, jp, jm;
+  index_t ID;
+  int k, spin;
 
-  old_E = compute_energy_cell(i, j, from_copy);
-  new_E = -old_E;   // Always true since E_i = s_i*(sum_neighs s_n)
-  deltaE = new_E - old_E;
+  // Flip cell
+  spin = -get_spin(i,j);
+  set_spin(i, j, spin);
 
-  if (trans_dynamics == DYNAMICS_METROPOLIS) {
+  // Update global energy and magnetization
+  global_magnetization += spin*2/(double)(NCELLS);
+  global_energy += deltaE;
 
-    // Metropolis dynamics
-    if (new_E <= old_E) {
-      // New energy is lower or unchanged: always flip cell
-      prob = 1.0;
-    } else {
-      // New energy is higher: try thermal flip
-      prob = exp(-deltaE/TEMP);
+  // Update magnetization of the samples the cell belongs to
+  if (TRACK_SAMPLES) {
+    getCellID(i, j, ID);
+    for (k = cell_sample_start[ID]; k < cell_sample_start[ID+1]; k++) {
+      sample_magn[cell_samples[k]] += spin*2/(double)(sample_size[cell_samples[k]]);
     }
+  }
 
-  } else if (trans_dynamics == DYNAMICS_GLAUBER) {
+}
 
-    // Glauber dynamics
-    prob = 1/(1 + exp(deltaE/TEMP));
+/*============================================================================*/
 
+// Does one generation of Wolff single-cluster dynamics
+// A live cell is picked at random and a cluster is grown from it: every
+// neighbor with the same (original) spin joins with probability
+// 1 - e^(-2/T). Cells are flipped as soon as they join, which keeps them
+// from joining twice and lets the energy change of each flip be computed
+// against the current grid, so global_energy stays exact. The cluster is
+// grown with the preallocated cluster_stack (no recursion or allocation).
+// A generation flips a fixed number wolff_clusters of clusters, chosen so
+// that they add up to about NLIVE flipped cells (so a generation costs about
+// the same as one sweep). Ending each generation when NLIVE cells have been
+// flipped instead would make the sampling times depend on the cluster sizes,
+// biasing the measurements towards ordered states. So wolff_clusters is
+// calibrated during the first WOLFF_CALIB_GENS generations at a temperature,
+// which do run until NLIVE cells are flipped, and is then kept fixed.
+// Dead cells (spin 0) never match the cluster spin, so they never join.
+void IsingModel::wolffGeneration () {
+
+  int i, j, spin, n, clusters;
+  index_t top, idx, flipped;
+  int ni[4], nj[4];
+  bool calibrating;
+
+  // Allocate the cluster stack if not allocated
+  // Every cell is pushed at most once per cluster
+  if (!cluster_stack) {
+    cluster_stack = (index_t*) malloc(NCELLS*sizeof(index_t));
   }
+  if (NLIVE == 0) return;
+
+  calibrating = (wolff_clusters == 0);
+  flipped = 0;
+  clusters = 0;
+  while (calibrating ? flipped < NLIVE : clusters < wolff_clusters) {
+
+    // Pick a random live seed cell and flip it
+    getCellCoords(live_cell(rng.below(NLIVE)), i, j);
+    spin = get_spin(i,j);
+    flipCell(i, j, -2*compute_energy_site(site(i,j), grid));
+    flipped++;
+#ifdef ISING_INSTRUMENT
+    counters.bulk_attempts++;
+    counters.bulk_accepts++;
+#endif
+    top = 0;
+    cluster_stack[top++] = site(i,j);
+
+    // Grow the cluster
+    while (top > 0) {
+      idx = cluster_stack[--top];
+      i = (int) (idx/STRIDE) - 1;
+      j = (int) (idx%STRIDE) - 1;
+      ni[0] = (i == 0) ? NGRID-1 : i-1;  nj[0] = j;
+      ni[1] = (i == NGRID-1) ? 0 : i+1;  nj[1] = j;
+      ni[2] = i;  nj[2] = (j == 0) ? NGRID-1 : j-1;
+      ni[3] = i;  nj[3] = (j == NGRID-1) ? 0 : j+1;
+      for (n = 0; n < 4; n++) {
+        idx = site(ni[n], nj[n]);
+        if (grid[idx] != spin) continue;
+#ifdef ISING_INSTRUMENT
+        counters.bulk_attempts++;
+#endif
+        if ((int) rng.next_u31() > wolff_thresh) continue;
+        flipCell(ni[n], nj[n], -2*compute_energy_site(idx, grid));
+        flipped++;
+#ifdef ISING_INSTRUMENT
+        counters.bulk_accepts++;
+#endif
+        cluster_stack[top++] = idx;
+      }
+    }
+    clusters++;
 
-  // Roll the "die"
-  if ((rand()/((double)RAND_MAX)) <= prob) {
-    do_flip = true;
-  } else {
-    do_flip = false;
   }
 
-  if (do_flip) {
+  // Calibrate the number of clusters per generation
+  if (calibrating) {
+    wolff_calib_gens++;
+    wolff_calib_clusters += clusters;
+    wolff_calib_cells += flipped;
+    if (wolff_calib_gens == WOLFF_CALIB_GENS) {
+      wolff_clusters = (int) round(NLIVE*wolff_calib_clusters/wolff_calib_cells);
+      if (wolff_clusters < 1) wolff_clusters = 1;
+    }
+  }
 
-    // Flip cell
-    grid[i][j] *= -1;
+}
 
-    // Update global energy and magnetization
-    global_magnetization += grid[i][j]*2/(double)(NCELLS);
-    global_energy += deltaE;
+/*============================================================================*/
 
-    // Update magnetization of sample if cell in list
-    if (track_samples) {
-      getCellID(i, j, ID);
-      for (s = 0; s < NUM_SAMPLES; s++) {
-        if (inSample(ID,s)) {
-          sample_magn[s] += grid[i][j]*2/(double)(sample_size[s]);
+// Does one generation of Swendsen-Wang multi-cluster dynamics
+// Every bond between two live cells with the same spin is activated with
+// probability 1 - e^(-2/T), the clusters of cells joined by active bonds are
+// labeled, and each cluster is flipped with probability 1/2.
+// Labeling is done by tiles: the rows are split into one band per thread,
+// each band is labeled independently with a union-find over cluster_parent,
+// and the bonds crossing band edges are merged serially afterwards. Every
+// root is the smallest cell ID of its cluster, and the random numbers are
+// hashed from a per-generation key and the bond (or root) ID, so the result
+// doesn't depend on the number of threads. The energy and magnetization are
+// recomputed afterwards. Dead cells need no checks: their spin 0 never
+// matches a live neighbor's, and flipping a cluster of them changes nothing.
+void IsingModel::swendsenWangGeneration () {
+
+  int b, nbands, s;
+  int64_t esum, msum;
+  uint64_t bond_key, flip_key;
+
+  // Allocate the parent array if not allocated
+  if (!cluster_parent) {
+    cluster_parent = (index_t*) malloc(NCELLS*sizeof(index_t));
+  }
+
+  nbands = max_threads();
+  if (nbands > NGRID) nbands = NGRID;
+  bond_key = rng.next_u64();
+  flip_key = rng.next_u64();
+
+  // Label each band of rows; bond 2*ID+0 goes right and 2*ID+1 down
+  #pragma omp parallel for schedule(static)
+  for (b = 0; b < nbands; b++) {
+    int i, j, spin;
+    index_t c, idx;
+    int r0 = (int) ((long long) NGRID*b/nbands);
+    int r1 = (int) ((long long) NGRID*(b+1)/nbands);
+    for (c = (index_t) r0*NGRID; c < (index_t) r1*NGRID; c++) {
+      cluster_parent[c] = c;
+    }
+    for (i = r0; i < r1; i++) {
+      for (j = 0; j < NGRID; j++) {
+        idx = site(i,j);
+        c = (index_t) i*NGRID + j;
+        spin = grid[idx];
+        if (grid[idx+1] == spin &&
+            (int) (mix64(bond_key + 2*(uint64_t)c) >> 33) <= wolff_thresh) {
+          uf_union(cluster_parent, c, (index_t) i*NGRID + (j+1)%NGRID);
+        }
+        if (i+1 < r1 && grid[idx+STRIDE] == spin &&
+            (int) (mix64(bond_key + 2*(uint64_t)c + 1) >> 33) <= wolff_thresh) {
+          uf_union(cluster_parent, c, c + NGRID);
         }
       }
     }
+  }
+
+  // Merge the down bonds leaving the last row of every band
+  for (b = 0; b < nbands; b++) {
+    int i, j;
+    index_t c, idx;
+    i = (int) ((long long) NGRID*(b+1)/nbands) - 1;
+    for (j = 0; j < NGRID; j++) {
+      idx = site(i,j);
+      c = (index_t) i*NGRID + j;
+      if (grid[idx+STRIDE] == grid[idx] &&
+          (int) (mix64(bond_key + 2*(uint64_t)c + 1) >> 33) <= wolff_thresh) {
+        uf_union(cluster_parent, c, (index_t) ((i+1)%NGRID)*NGRID + j);
+      }
+    }
+  }
 
+  // Flip every cluster with probability 1/2 (the parents are only read here)
+  #pragma omp parallel for schedule(static)
+  for (int i = 0; i < NGRID; i++) {
+    int j;
+    index_t r;
+#ifdef ISING_INSTRUMENT
+    uint64_t flips = 0;
+#endif
+    for (j = 0; j < NGRID; j++) {
+      r = (index_t) i*NGRID + j;
+      while (cluster_parent[r] != r) r = cluster_parent[r];
+      if (mix64(flip_key + r) >> 63) {
+        grid[site(i,j)] = -grid[site(i,j)];
+#ifdef ISING_INSTRUMENT
+        flips += (grid[site(i,j)] != 0);
+#endif
+      }
+    }
+#ifdef ISING_INSTRUMENT
+    #pragma omp atomic
+    counters.bulk_accepts += flips;
+#endif
+  }
+#ifdef ISING_INSTRUMENT
+  counters.bulk_attempts += NLIVE;
+#endif
+  sync_halo(grid);
+
+  // Recompute global energy and magnetization (as in update_energy and
+  // update_magnetization)
+  esum = 0;
+  msum = 0;
+  #pragma omp parallel for schedule(static) reduction(+:esum,msum)
+  for (int i = 0; i < NGRID; i++) {
+    for (int j = 0; j < NGRID; j++) {
+      esum += compute_energy_site(site(i,j), grid);
+      msum += grid[site(i,j)];
+    }
+  }
+  global_energy = esum/2;
+  global_magnetization = msum/(double)(NCELLS);
+
+  // Recompute sample magnetizations
+  if (track_samples) {
+    for (s = 0; s < NUM_SAMPLES; s++) {
+      update_sample_magn(s);
+    }
   }
 
 }
 
 /*============================================================================*/
 
+// Does one generation of n-fold way (Bortz-Kalos-Lebowitz) dynamics
+// A rejection-free, continuous-time version of Metropolis dynamics with
+// random cell order: every live cell flips at the rate nfold_rate of its
+// class (the Metropolis acceptance of its flip) per sweep, so instead of
+// attempting flips that will mostly be rejected, each step draws the time to
+// the next flip from the total rate R = sum_k n_k*rate_k (an exponential
+// waiting time of mean 1/R sweeps), picks the class of the flip with
+// probability n_k*rate_k/R and flips a uniformly chosen cell of it. The cells
+// are kept in nfold_cells grouped by class, and the classes of the flipped
+// cell and its neighbors are updated in O(1) (see nfold_update).
+// A generation advances the clock by nfold_step sweeps (1 by default), so
+// generations are a measure of physical time, comparable to the sweeps of
+// the other dynamics, and equally spaced records of the series sample the
+// states by the time they last. The flip that would cross the end of the
+// generation is dropped: the waiting times are memoryless, so drawing the
+// next one afresh at the start of the next generation is exact. This pays
+// off at low temperatures, where nearly every sweep attempt is rejected;
+// near and above Tc a sweep is cheaper.
+void IsingModel::nfoldGeneration () {
+
+  int k, i, j;
+  index_t ID, pos;
+  double R, left, x;
+
+  if (!nfold_valid) nfold_build();
+#ifdef ISING_INSTRUMENT
+  // The flips a sweep would have attempted in the same time
+  counters.bulk_attempts += (uint64_t) (nfold_step*NLIVE);
+#endif
+
+  left = nfold_step;
+  while (true) {
+
+    // Total rate, and time to the next flip
+    R = 0.0;
+    for (k = 0; k < NUM_DELTAE; k++) {
+      R += (nfold_start[k+1] - nfold_start[k])*nfold_rate[k];
+    }
+    if (R <= 0) break;
+    left -= -log(1.0 - rng.uniform())/R;
+    if (left < 0) break;
+
+    // Class of the flip (the last non-empty one if rounding overshoots),
+    // then a cell of the class
+    x = rng.uniform()*R;
+    for (k = 0; k < NUM_DELTAE-1; k++) {
+      if (nfold_start[k+1] == nfold_start[k]) continue;
+      x -= (nfold_start[k+1] - nfold_start[k])*nfold_rate[k];
+      if (x < 0) break;
+    }
+    while (nfold_start[k+1] == nfold_start[k]) k--;
+    pos = nfold_start[k] + rng.below(nfold_start[k+1] - nfold_start[k]);
+    ID = nfold_cells[pos];
+
+    // Flip it, and update the classes around it
+    getCellCoords(ID, i, j);
+    flipCell(i, j, 2*(k-4));
+#ifdef ISING_INSTRUMENT
+    counters.bulk_accepts++;
+#endif
+    nfold_update(i, j);
+    nfold_update(i == 0 ? NGRID-1 : i-1, j);
+    nfold_update(i == NGRID-1 ? 0 : i+1, j);
+    nfold_update(i, j == 0 ? NGRID-1 : j-1);
+    nfold_update(i, j == NGRID-1 ? 0 : j+1);
+
+  }
+
+}
+
+/*============================================================================*/
+
+// Builds the n-fold way index from the grid (see nfoldGeneration)
+// The live cells are sorted by class with a counting sort, in live cell
+// order. Allocates the index arrays if not allocated.
+void IsingModel::nfold_build () {
+
+  int k, i, j;
+  index_t n, ID;
+  index_t next[NUM_DELTAE];
+
+  if (!nfold_cells) {
+    nfold_cells = (index_t*) malloc(NCELLS*sizeof(index_t));
+    nfold_pos = (index_t*) malloc(NCELLS*sizeof(index_t));
+    nfold_class = (int8_t*) malloc(NCELLS*sizeof(int8_t));
+  }
+
+  // Class of every live cell, and number of cells of each class
+  memset(next, 0, sizeof(next));
+  for (n = 0; n < NLIVE; n++) {
+    ID = live_cell(n);
+    getCellCoords(ID, i, j);
+    k = -compute_energy_site(site(i,j), grid) + 4;
+    nfold_class[ID] = k;
+    next[k]++;
+  }
+
+  // Start of each class, and the cells in it
+  nfold_start[0] = 0;
+  for (k = 0; k < NUM_DELTAE; k++) {
+    nfold_start[k+1] = nfold_start[k] + next[k];
+    next[k] = nfold_start[k];
+  }
+  for (n = 0; n < NLIVE; n++) {
+    ID = live_cell(n);
+    k = nfold_class[ID];
+    nfold_cells[next[k]] = ID;
+    nfold_pos[ID] = next[k]++;
+  }
+
+  nfold_valid = true;
+
+}
+
+/*============================================================================*/
+
+// Moves cell (i,j) of the n-fold way index to its current class, if it
+// changed (dead cells are skipped)
+// The classes are contiguous in nfold_cells, so the cell is swapped to the
+// edge of its class, the edge moved past it, and so on until it reaches its
+// new class: at most NUM_DELTAE-1 steps (two for a neighbor of a flip).
+void IsingModel::nfold_update (int i, int j) {
+
+  int k, knew;
+  index_t ID, pos, last, other;
+
+  if (grid[site(i,j)] == 0) return;
+  getCellID(i, j, ID);
+  k = nfold_class[ID];
+  knew = -compute_energy_site(site(i,j), grid) + 4;
+  if (knew == k) return;
+
+  pos = nfold_pos[ID];
+  while (k != knew) {
+    // Swap with the last cell of class k, which then ends one cell earlier
+    // (or with the first, which then starts one cell later)
+    if (k < knew) {
+      last = --nfold_start[k+1];
+      k++;
+    } else {
+      last = nfold_start[k]++;
+      k--;
+    }
+    other = nfold_cells[last];
+    nfold_cells[pos] = other;
+    nfold_pos[other] = pos;
+    nfold_cells[last] = ID;
+    pos = last;
+  }
+  nfold_pos[ID] = pos;
+  nfold_class[ID] = knew;
+
+}
+
+/*============================================================================*/
+
+// Tabulates the flip acceptance thresholds for the current temperature and
+// dynamics. With nearest-neighbor coupling the energy change of a flip can
+// only be deltaE = -8, -6, ..., +8, which is stored at index deltaE/2 + 4.
+// The transition probability is:
+// DYNAMICS_METROPOLIS: 1 if deltaE <= 0, e^(-deltaE/T) otherwise
+// DYNAMICS_GLAUBER: 1/(1 + e^(deltaE/T))
+// (Cluster dynamics don't use the table, and get the Metropolis one.)
+// DYNAMICS_NFOLD uses the Metropolis probabilities as the flip rates of the
+// classes, stored in nfold_rate.
+// A flip is accepted when a uniform integer in [0,2^31) is <= threshold,
+// which is equivalent to u <= probability for a uniform u in [0,1). Certain
+// flips are marked ACCEPT_ALWAYS so that they don't consume a random number.
+// The same thresholds are stored in simd_thresh for the vector kernels.
+void IsingModel::update_acceptance () {
+  int k, deltaE;
+  double prob;
+  for (k = 0; k < NUM_DELTAE; k++) {
+    deltaE = 2*(k-4);
+    if (trans_dynamics == DYNAMICS_GLAUBER) {
+      prob = 1/(1 + exp(deltaE/TEMP));
+    } else {
+      if (deltaE <= 0) prob = 1.0;
+      else prob = exp(-deltaE/TEMP);
+    }
+    nfold_rate[k] = prob;
+    if (prob >= 1.0) {
+      accept_thresh[k] = ACCEPT_ALWAYS;
+      simd_thresh[k] = INT32_MAX;
+    } else {
+      accept_thresh[k] = (int) floor(prob*2147483647.0);
+      simd_thresh[k] = accept_thresh[k];
+    }
+  }
+  for (k = NUM_DELTAE; k < SIMD_LANES; k++) {
+    simd_thresh[k] = -1;
+  }
+  wolff_thresh = (int) floor((1 - exp(-2/TEMP))*2147483647.0);
+  wolff_clusters = 0;
+  wolff_calib_gens = 0;
+  wolff_calib_clusters = 0.0;
+  wolff_calib_cells = 0.0;
+  table_temp = TEMP;
+  table_dynamics = trans_dynamics;
+}
+
+/*============================================================================*/
+
+// Reseeds the model's random number generator
+// The main stream (used by the serial strategies and for initialization) is
+// stream 0 of the seed; thread t of the multithreaded strategies uses stream
+// t+1, and the vector kernels are seeded from further streams. For a fixed
+// seed and number of threads, runs are reproducible.
+// If samples are tracked, they are picked again with the new seed, so this
+// should be called right after construction.
+void IsingModel::setSeed (uint64_t p_seed) {
+  seed = p_seed;
+  rng.seed(seed, 0);
+  free(thread_rng);
+  thread_rng = NULL;
+  num_thread_rng = 0;
+  free(simd_rng);
+  simd_rng = NULL;
+  num_simd_rng = 0;
+  if (track_samples) pickSamples();
+}
+
+/*============================================================================*/
+
+// Makes sure there is an RNG stream for every thread
+void IsingModel::init_thread_rng () {
+  if (num_thread_rng < max_threads()) {
+    free(thread_rng);
+    num_thread_rng = max_threads();
+    thread_rng = (IsingRNG*) malloc(num_thread_rng*sizeof(IsingRNG));
+    for (int t = 0; t < num_thread_rng; t++) {
+      thread_rng[t].seed(seed, t+1);
+    }
+  }
+}
+
+/*============================================================================*/
+
+// Saves the full state of the model to a checkpoint file (see Checkpoint.h)
+// This includes the grid and dead cells, the generation, all statistics
+// (global, sample and running window), the flip orders and the state of every
+// RNG stream, so that a model restored with loadCheckpoint continues exactly
+// as this one would (with the same number of threads). Scratch arrays
+// (grid_copy, cluster arrays) are not saved.
+// Returns false if the checkpoint couldn't be written.
+bool IsingModel::saveCheckpoint (const char* fname) {
+
+  CheckpointWriter ckp;
+  bool has_dead, has_order, has_tiles;
+
+  ckp.open(fname, "SPIN");
+
+  // Parameters, checked on load
+  ckp.put(NGRID);
+  ckp.put(NUM_SAMPLES);
+  ckp.put(NUM_DATA);
+  ckp.put(track_samples);
+
+  // Settings
+  ckp.put(TEMP);
+  ckp.put(trans_dynamics);
+  ckp.put(flip_strategy);
+  ckp.put(START_GEN);
+  ckp.put(cur_gen);
+  ckp.put(nfold_step);
+
+  // Grid and dead cells
+  ckp.put_array(grid, LATTICE_SIZE);
+  has_dead = (dead_cells != NULL);
+  ckp.put(has_dead);
+  ckp.put(useDeadCells);
+  ckp.put(DEAD_DENS);
+  if (has_dead) ckp.put_array(dead_cells, LATTICE_SIZE);
+  has_order = (flip_order != NULL);
+  ckp.put(has_order);
+  if (has_order) ckp.put_array(flip_order, NLIVE);
+  has_tiles = (tile_cells != NULL);
+  ckp.put(has_tiles);
+  if (has_tiles) ckp.put_array(tile_cells, NLIVE);
+
+  // Global statistics
+  ckp.put(global_energy);
+  ckp.put(global_magnetization);
+  ckp.put(global_mean);
+  ckp.put(global_variance);
+  ckp.put(global_M2);
+  ckp.put(global_npoints);
+  ckp.put(equil);
+
+  // Sample statistics
+  if (track_samples) {
+    for (int s = 0; s < NUM_SAMPLES; s++) {
+      ckp.put(sample_size[s]);
+      ckp.put_array(sample_cells[s], sample_size[s]);
+    }
+    ckp.put_array(sample_magn, NUM_SAMPLES);
+    ckp.put_array(sample_mean, NUM_SAMPLES);
+    ckp.put_array(sample_var, NUM_SAMPLES);
+    ckp.put_array(sample_M2, NUM_SAMPLES);
+    ckp.put_array(sample_npts, NUM_SAMPLES);
+    ckp.put_array(rundata, NUM_DATA);
+  }
+  ckp.put(run_mean);
+  ckp.put(run_var);
+  ckp.put(nextdata);
+
+  // Wolff calibration
+  ckp.put(wolff_clusters);
+  ckp.put(wolff_calib_gens);
+  ckp.put(wolff_calib_clusters);
+  ckp.put(wolff_calib_cells);
+
+  // N-fold way index, if valid (the order of the cells within each class
+  // depends on the history of the flips, so it can't just be rebuilt)
+  ckp.put(nfold_valid);
+  if (nfold_valid) {
+    ckp.put_array(nfold_cells, NCELLS);
+    ckp.put_array(nfold_pos, NCELLS);
+    ckp.put_array(nfold_class, NCELLS);
+    ckp.put_array(nfold_start, NUM_DELTAE+1);
+  }
+
+  // RNG streams
+  ckp.put(seed);
+  ckp.put(rng);
+  ckp.put(num_thread_rng);
+  ckp.put_array(thread_rng, num_thread_rng);
+  ckp.put(num_simd_rng);
+  ckp.put_array(simd_rng, num_simd_rng*SIMD_RNG_WORDS);
+
+  return ckp.close();
+
+}
+
+/*============================================================================*/
+
+// Restores the full state of the model from a checkpoint written by
+// saveCheckpoint
+// The model must have been constructed with the same parameters (grid size,
+// samples and running window); this is checked before anything is modified.
+// Returns false if the checkpoint couldn't be read or doesn't match, in which
+// case the model should not be used further if the failure came after the
+// parameter checks (a truncated file).
+bool IsingModel::loadCheckpoint (const char* fname) {
+
+  CheckpointReader ckp;
+  bool has_dead, has_order, has_tiles;
+  int wc, wg;
+  double wcc, wce;
+
+  if (!ckp.open(fname, "SPIN")) return ckp.close();
+
+  // Parameters
+  ckp.expect(NGRID);
+  ckp.expect(NUM_SAMPLES);
+  ckp.expect(NUM_DATA);
+  ckp.expect(track_samples);
+  if (!ckp.ok) return ckp.close();
+
+  // Settings
+  ckp.get(TEMP);
+  ckp.get(trans_dynamics);
+  ckp.get(flip_strategy);
+  ckp.get(START_GEN);
+  ckp.get(cur_gen);
+  ckp.get(nfold_step);
+
+  // Grid and dead cells
+  ckp.get_array(grid, LATTICE_SIZE);
+  ckp.get(has_dead);
+  ckp.get(useDeadCells);
+  ckp.get(DEAD_DENS);
+  if (has_dead) {
+    if (!dead_cells) dead_cells = alloc_lattice<bool>(LATTICE_SIZE);
+    ckp.get_array(dead_cells, LATTICE_SIZE);
+  } else {
+    free(dead_cells);
+    dead_cells = NULL;
+    useDeadCells = false;
+  }
+  if (ckp.ok) update_live_cells();
+  ckp.get(has_order);
+  if (ckp.ok && has_order) {
+    if (!flip_order) update_flip_order();
+    ckp.get_array(flip_order, NLIVE);
+  }
+  ckp.get(has_tiles);
+  if (ckp.ok && has_tiles) {
+    if (!tile_cells) update_tile_cells();
+    ckp.get_array(tile_cells, NLIVE);
+  }
+
+  // Global statistics
+  ckp.get(global_energy);
+  ckp.get(global_magnetization);
+  ckp.get(global_mean);
+  ckp.get(global_variance);
+  ckp.get(global_M2);
+  ckp.get(global_npoints);
+  ckp.get(equil);
+
+  // Sample statistics
+  if (track_samples) {
+    for (int s = 0; s < NUM_SAMPLES; s++) {
+      ckp.expect(sample_size[s]);
+      ckp.get_array(sample_cells[s], sample_size[s]);
+    }
+    ckp.get_array(sample_magn, NUM_SAMPLES);
+    ckp.get_array(sample_mean, NUM_SAMPLES);
+    ckp.get_array(sample_var, NUM_SAMPLES);
+    ckp.get_array(sample_M2, NUM_SAMPLES);
+    ckp.get_array(sample_npts, NUM_SAMPLES);
+    ckp.get_array(rundata, NUM_DATA);
+    if (ckp.ok) index_samples();
+  }
+  ckp.get(run_mean);
+  ckp.get(run_var);
+  ckp.get(nextdata);
+
+  // Wolff calibration (restored after rebuilding the tables, which resets it)
+  ckp.get(wc);
+  ckp.get(wg);
+  ckp.get(wcc);
+  ckp.get(wce);
+  update_acceptance();
+  wolff_clusters = wc;
+  wolff_calib_gens = wg;
+  wolff_calib_clusters = wcc;
+  wolff_calib_cells = wce;
+
+  // N-fold way index
+  ckp.get(nfold_valid);
+  if (!ckp.ok) nfold_valid = false;
+  if (nfold_valid) {
+    if (!nfold_cells) {
+      nfold_cells = (index_t*) malloc(NCELLS*sizeof(index_t));
+      nfold_pos = (index_t*) malloc(NCELLS*sizeof(index_t));
+      nfold_class = (int8_t*) malloc(NCELLS*sizeof(int8_t));
+    }
+    ckp.get_array(nfold_cells, NCELLS);
+    ckp.get_array(nfold_pos, NCELLS);
+    ckp.get_array(nfold_class, NCELLS);
+    ckp.get_array(nfold_start, NUM_DELTAE+1);
+    if (!ckp.ok) nfold_valid = false;
+  }
+
+  // RNG streams
+  ckp.get(seed);
+  ckp.get(rng);
+  free(thread_rng);
+  ckp.get(num_thread_rng);
+  if (!ckp.ok) num_thread_rng = 0;
+  thread_rng = (IsingRNG*) malloc(num_thread_rng*sizeof(IsingRNG));
+  ckp.get_array(thread_rng, num_thread_rng);
+  free(simd_rng);
+  simd_rng = NULL;
+  ckp.get(num_simd_rng);
+  if (!ckp.ok) num_simd_rng = 0;
+  if (num_simd_rng > 0) {
+    simd_rng = (uint32_t*) aligned_alloc(LATTICE_ALIGN, num_simd_rng*SIMD_RNG_WORDS*sizeof(uint32_t));
+    ckp.get_array(simd_rng, num_simd_rng*SIMD_RNG_WORDS);
+  }
+
+  return ckp.close();
+
+}
+
+/*============================================================================*/
+
+// Sets the temperature and updates the acceptance table
+void IsingModel::setTemperature (double p_TEMP) {
+  TEMP = p_TEMP;
+  update_acceptance();
+}
+
+/*============================================================================*/
+
+// Sets the transition dynamics and updates the acceptance table
+void IsingModel::setDynamics (int p_dynamics) {
+  trans_dynamics = p_dynamics;
+  update_acceptance();
+}
+
+/*============================================================================*/
+
 // Determines whether a cell is in the cell list of sample number s
-// Assumes the cell list is sorted!
-bool IsingModel::inSample(int ID, int s) {
-  int idx;
-  idx = binary_search(sample_cells[s], sample_size[s], ID);
-  if (idx != -1) return true;
-  else return false;
+// Uses the per-cell membership index built by index_samples.
+bool IsingModel::inSample(index_t ID, int s) {
+  for (int k = cell_sample_start[ID]; k < cell_sample_start[ID+1]; k++) {
+    if (cell_samples[k] == s) return true;
+  }
+  return false;
 }
 
 /*============================================================================*/
@@ -578,6 +1784,7 @@ void IsingModel::update_stats () {
   } else {
     global_variance = global_M2/(global_npoints-1);
   }
+  equil.add(cur_gen, global_magnetization, global_energy/(double)NCELLS);
 }
 
 /*============================================================================*/
@@ -604,11 +1811,7 @@ void IsingModel::update_sample_stats () {
 // Remembers last NUM_DATA magnetization values for running mean/variance
 void IsingModel::update_data () {
   rundata[nextdata] = global_magnetization;
-  if (nextdata>=NUM_DATA) {
-    nextdata = 0;
-  } else {
-    nextdata++;
-  }
+  nextdata = (nextdata+1) % NUM_DATA;
 }
 
 /*============================================================================*/
@@ -632,28 +1835,58 @@ void IsingModel::running_stats () {
 
 // Randomly selects samples of cells for statistical followup
 // The arrays sample_cells are filled with cell IDs, and then each is sorted
-// for quick cell lookup.
+// and the per-cell membership index is rebuilt.
 void IsingModel::pickSamples () {
-  int i, s, x;
-  int* pool = (int*) malloc(NCELLS*sizeof(int));
+  int i, s;
+  FeistelPermutation perm;
   for (s = 0; s < NUM_SAMPLES; s++) {
-    for (i = 0; i < NCELLS; i++) {
-      pool[i] = i;
-    }
+    perm.init(NCELLS, rng.next_u64());
     for (i = 0; i < sample_size[s]; i++) {
-      x = rand() % (NCELLS-i) + i;
-      sample_cells[s][i] = pool[x];
-      pool[x] = pool[i];
+      sample_cells[s][i] = perm(i);
     }
     quicksort(sample_cells[s], sample_size[s]);
   }
+  index_samples();
+}
+
+/*============================================================================*/
+
+// Builds the per-cell sample membership index from the sample cell lists
+// With it a flip only touches the samples that contain the flipped cell,
+// instead of searching every sample. The samples of each cell are listed
+// in increasing order.
+void IsingModel::index_samples () {
+  int i, s;
+  index_t ID;
+  for (ID = 0; ID <= NCELLS; ID++) {
+    cell_sample_start[ID] = 0;
+  }
+  for (s = 0; s < NUM_SAMPLES; s++) {
+    for (i = 0; i < sample_size[s]; i++) {
+      cell_sample_start[sample_cells[s][i]+1]++;
+    }
+  }
+  for (ID = 0; ID < NCELLS; ID++) {
+    cell_sample_start[ID+1] += cell_sample_start[ID];
+  }
+  for (s = 0; s < NUM_SAMPLES; s++) {
+    for (i = 0; i < sample_size[s]; i++) {
+      ID = sample_cells[s][i];
+      cell_samples[cell_sample_start[ID]++] = s;
+    }
+  }
+  // Each start now points at the end of its cell's list; shift back
+  for (ID = NCELLS; ID > 0; ID--) {
+    cell_sample_start[ID] = cell_sample_start[ID-1];
+  }
+  cell_sample_start[0] = 0;
 }
 
 /*============================================================================*/
 
 // Converts a cell ID to an (x,y) position
 // Coords and IDs start at zero.
-void IsingModel::getCellCoords(int ID, int &x, int &y) {
+void IsingModel::getCellCoords(index_t ID, int &x, int &y) {
   x = ID % NGRID;
   y = ID / NGRID;
 }
@@ -662,8 +1895,8 @@ void IsingModel::getCellCoords(int ID, int &x, int &y) {
 
 // Converts an (x,y) position into a cell ID
 // Coords and IDs start at zero.
-void IsingModel::getCellID(int x, int y, int &ID) {
-  ID = x + y*NGRID;
+void IsingModel::getCellID(int x, int y, index_t &ID) {
+  ID = x + (index_t) y*NGRID;
 }
 
 /*============================================================================*/
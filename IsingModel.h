@@ -1,6 +1,11 @@
 #ifndef ISING_H
 #define ISING_H
 
+#include <stdint.h>
+#include "Random.h"
+#include "Instrument.h"
+#include "Binning.h"
+
 /*===============================\\
 || Ising Model class declaration ||
 \\===============================*/
@@ -13,6 +18,16 @@ const double TEMP_CRIT = 2.26918531421302;
 const int INIT_MAGN_AUTO = 0;
 const int INIT_MAGN_MANUAL = 1;
 
+// Storage type of a single spin (+1 or -1, or 0 for a dead cell)
+typedef int8_t spin_t;
+
+// Type of cell IDs and lattice indices, and of counts of cells
+// 64 bits, so that grids may have more than 2^31 cells (NGRID > 46340).
+typedef int64_t index_t;
+
+// Alignment (in bytes) of the lattice arrays
+const int LATTICE_ALIGN = 64;
+
 class IsingModel {
 
   public:
@@ -30,21 +45,69 @@ class IsingModel {
   int NGRID;
 
   // Total number of cells, equal to NGRID*NGRID
-  int NCELLS;
+  index_t NCELLS;
 
-  // 2D grid for spin states
-  // grid[NGRID][NGRID]
-  int** grid;
+  // log2(NGRID) if NGRID is a power of two, -1 otherwise
+  int NGRID_SHIFT;
+
+  // Row length of the padded lattice, equal to NGRID+2
+  int STRIDE;
 
-  // Copy of the grid (not allocated if not needed)
-  // grid_copy[NGRID][NGRID]
-  int** grid_copy;
+  // Total number of entries in the padded lattice, equal to STRIDE*STRIDE
+  index_t LATTICE_SIZE;
 
-  // Dead cells
-  bool** dead_cells;
+  // 2D grid for spin states
+  // The grid is stored contiguously, row by row, surrounded by a one-cell
+  // halo that mirrors the opposite edge so that the periodic neighbors of
+  // every cell are always at offsets +-1 and +-STRIDE. Use site(i,j) to get
+  // the index of cell (i,j); the halo is kept in sync by set_spin().
+  // grid[LATTICE_SIZE]
+  spin_t* grid;
+
+  // Copy of the grid, same layout (not allocated if not needed)
+  // grid_copy[LATTICE_SIZE]
+  spin_t* grid_copy;
+
+  // Dead cells, same layout as the grid (not allocated if not needed)
+  // Dead cells are vacancies: their spin is kept at 0, so they drop out of
+  // the energy of their neighbors with no tests, and the sweeps only visit
+  // the live cells listed below (see update_live_cells). They still count
+  // in NCELLS for the magnetization and energy per cell.
+  // dead_cells[LATTICE_SIZE]
+  bool* dead_cells;
   bool useDeadCells;
   double DEAD_DENS;
 
+  // Live cells: their number, and their IDs in row-major order (i.e. the
+  // order of STRATEGY_SEQUENTIAL), only listed if there are dead cells
+  // (otherwise the k-th live cell is the k-th cell in row-major order; use
+  // live_cell(k) or live_coords(k,...))
+  // live_cells[NCELLS], of which the first NLIVE are used
+  index_t NLIVE;
+  index_t* live_cells;
+
+  // Columns of the live cells of each color, row by row, for the
+  // checkerboard sweep: the live cells of color c in row i are in columns
+  // color_cells[color_start[2*i+c] .. color_start[2*i+c+1]-1], only listed
+  // if there are dead cells (otherwise they are every other column)
+  // color_cells[NCELLS], color_start[2*NGRID+1]
+  int* color_cells;
+  index_t* color_start;
+
+  // Live cells grouped by tiles of TILE_SIZE x TILE_SIZE cells, for
+  // STRATEGY_TILED: the tiles are in Morton (Z-curve) order, and the live
+  // cells of tile t are tile_cells[tile_start[t] .. tile_start[t+1]-1], in
+  // the order of the last sweep, as offsets row*TILE_SIZE + column from the
+  // tile's first cell (tile_row[t], tile_col[t]). Allocated and built on
+  // first use, and rebuilt by update_live_cells once allocated.
+  // tile_cells[NCELLS], tile_start[num_tiles+1], tile_row/col[num_tiles]
+  static const int TILE_SIZE = 64;
+  uint16_t* tile_cells;
+  index_t* tile_start;
+  int* tile_row;
+  int* tile_col;
+  int num_tiles;
+
   // Flip strategy.
   // See the doGeneration class documentation for information on valid options.
   int flip_strategy;
@@ -53,27 +116,119 @@ class IsingModel {
   static const int STRATEGY_SEQUENTIAL = 2;
   static const int STRATEGY_PEANO = 3;
   static const int STRATEGY_COPY = 4;
+  static const int STRATEGY_CHECKERBOARD = 5;
+  static const int STRATEGY_SIMD = 6;
+  static const int STRATEGY_TILED = 7;
 
   // Dynamics
   int trans_dynamics;
   static const int DYNAMICS_METROPOLIS = 0;
   static const int DYNAMICS_GLAUBER = 1;
-
-  // List of cell IDs for randomized flipping order
-  // flip_order[NCELLS]
-  int* flip_order;
+  static const int DYNAMICS_WOLFF = 2;
+  static const int DYNAMICS_SWENDSEN_WANG = 3;
+  static const int DYNAMICS_NFOLD = 4;
+
+  // Flip acceptance table, indexed by deltaE/2 + 4 (see update_acceptance)
+  // Built for table_temp and table_dynamics; rebuilt when these change.
+  static const int NUM_DELTAE = 9;
+  static const int ACCEPT_ALWAYS = -1;
+  int accept_thresh[NUM_DELTAE];
+  double table_temp;
+  int table_dynamics;
+
+  // Threshold for adding a cell to a Wolff cluster, or activating a
+  // Swendsen-Wang bond (probability 1-e^(-2/T))
+  int wolff_thresh;
+
+  // Number of Wolff clusters flipped per generation (0 while calibrating),
+  // and calibration accumulators (see wolffGeneration)
+  static const int WOLFF_CALIB_GENS = 10;
+  int wolff_clusters;
+  int wolff_calib_gens;
+  double wolff_calib_clusters;
+  double wolff_calib_cells;
+
+  // Stack of cells (lattice indices) for growing Wolff clusters
+  // Allocated on first use; cluster_stack[NCELLS]
+  index_t* cluster_stack;
+
+  // Union-find parents of the cells for Swendsen-Wang, indexed by cell ID
+  // Allocated on first use; cluster_parent[NCELLS]
+  index_t* cluster_parent;
+
+  // Index of the live cells by flip class for DYNAMICS_NFOLD (see
+  // nfoldGeneration), with the class of cell ID at index deltaE/2 + 4 of its
+  // flip: the cells of class k are nfold_cells[nfold_start[k] ..
+  // nfold_start[k+1]-1], and cell ID is at nfold_cells[nfold_pos[ID]] and in
+  // class nfold_class[ID]. Built on first use and whenever nfold_valid is
+  // unset (which anything that rewrites the grid does), then kept up to date
+  // by the n-fold way flips.
+  // nfold_cells[NCELLS], nfold_pos[NCELLS], nfold_class[NCELLS]
+  index_t* nfold_cells;
+  index_t* nfold_pos;
+  int8_t* nfold_class;
+  index_t nfold_start[NUM_DELTAE+1];
+  bool nfold_valid;
+
+  // Flip rate of each class for DYNAMICS_NFOLD (the Metropolis acceptance
+  // probability), and the time in sweeps spanned by one generation
+  double nfold_rate[NUM_DELTAE];
+  double nfold_step;
+
+  // Vector instruction set used by STRATEGY_SIMD
+  // Detected at construction; may be lowered by the user (e.g. to compare).
+  int simd_isa;
+  static const int SIMD_NONE = 0;
+  static const int SIMD_AVX2 = 1;
+  static const int SIMD_AVX512 = 2;
+
+  // Acceptance thresholds for the vector kernels, indexed like accept_thresh
+  // A flip is accepted when a 31-bit uniform is <= the threshold (certain
+  // flips have a threshold of INT32_MAX). Padded to one full vector.
+  static const int SIMD_LANES = 16;
+  int32_t simd_thresh[SIMD_LANES];
+
+  // Per-thread xoshiro128** states of the vector kernels (one per lane),
+  // seeded from streams SIMD_STREAM+t
+  // simd_rng[num_simd_rng*SIMD_RNG_WORDS]
+  static const int SIMD_RNG_WORDS = 4*SIMD_LANES;
+  static const uint64_t SIMD_STREAM = 1ULL << 32;
+  uint32_t* simd_rng;
+  int num_simd_rng;
+
+  // Live cell IDs in the order of the last STRATEGY_SHUFFLE sweep, as 32-bit
+  // IDs. Allocated and built on first use if NCELLS <= SHUFFLE_ARRAY_MAX,
+  // and reset to increasing IDs by update_live_cells once allocated; larger
+  // grids follow a FeistelPermutation instead, which needs no memory but
+  // costs more per cell.
+  // flip_order[NCELLS], of which the first NLIVE are used
+  static const index_t SHUFFLE_ARRAY_MAX = (index_t) 1 << 28;
+  uint32_t* flip_order;
+
+  // Random number generation (see setSeed)
+  // seed: seed of all the streams used by the model
+  // rng: main stream
+  // thread_rng[num_thread_rng]: per-thread streams
+  uint64_t seed;
+  IsingRNG rng;
+  IsingRNG* thread_rng;
+  int num_thread_rng;
 
   // Current generation (will never reset)
   int cur_gen;
 
   // Global statistics
-  int global_energy;
+  int64_t global_energy;
   double global_magnetization;
   double global_mean;
   double global_variance;
   double global_M2;
   int global_npoints;
 
+  // Equilibration, means, errors and autocorrelation times of |M| and of
+  // the energy per cell (see Binning.h), updated with the global statistics
+  EquilibriumStats equil;
+
   // Track statistics in samples?
   bool track_samples;
 
@@ -103,7 +258,13 @@ class IsingModel {
 
   // List of cells to use for sample statistics
   // sample_cells[NUM_SAMPLES][<number of cells in this sample>]
-  int** sample_cells;
+  index_t** sample_cells;
+
+  // Samples each cell belongs to, in compressed form: the samples of cell ID
+  // are cell_samples[cell_sample_start[ID] .. cell_sample_start[ID+1]-1]
+  // cell_sample_start[NCELLS+1], cell_samples[<sum of sample sizes>]
+  int* cell_sample_start;
+  int* cell_samples;
 
   // Number of points to remember for running mean/variance
   int NUM_DATA;
@@ -113,12 +274,18 @@ class IsingModel {
   double run_mean, run_var;
   int nextdata;
 
+#ifdef ISING_INSTRUMENT
+  // Runtime counters (see Instrument.h), reset by reset_stats
+  IsingCounters counters;
+#endif
+
   /*==========================================================================*/
 
   /* MEMBER FUNCTIONS */
 
   IsingModel(int, double);
   IsingModel(int, double, int, int, int, int, int);
+  ~IsingModel();
   void common_constructor();
   int compute_energy_cell(int, int, bool);
   void randomize();
@@ -130,16 +297,125 @@ class IsingModel {
   void update_sample_magn(int);
   void activateDeadCells();
   void randomizeDead(double);
+  void update_dead_cells();
+  void update_live_cells();
+  void update_tile_cells();
+  void update_flip_order();
+  void clear_dead_spins();
+  void update_acceptance();
+  void setTemperature(double);
+  void setDynamics(int);
+  void setSeed(uint64_t);
+  void init_thread_rng();
+  bool saveCheckpoint(const char*);
+  bool loadCheckpoint(const char*);
   void doGeneration();
+  void sweep();
+  template<bool, bool> void sweepKernel();
+  void checkerboardSweep();
+  void simdSweep();
+  static int detect_simd();
   void tryCellFlip(int,int,bool);
+  template<bool, bool> void tryCellFlipKernel(int,int);
+  void flipCell(int,int,int);
+  template<bool> void flipCellKernel(int,int,int);
+  void wolffGeneration();
+  void swendsenWangGeneration();
+  void nfoldGeneration();
+  void nfold_build();
+  void nfold_update(int,int);
   void update_stats();
   void update_sample_stats();
   void update_data();
   void running_stats();
-  void getCellCoords(int, int&, int&);
-  void getCellID(int, int, int&);
-  bool inSample(int,int);
+  void getCellCoords(index_t, int&, int&);
+  void getCellID(int, int, index_t&);
+  bool inSample(index_t,int);
   void pickSamples();
+  void index_samples();
+
+  // Index of cell (i,j) in the padded lattice
+  inline index_t site(int i, int j) {
+    return (index_t) (i+1)*STRIDE + (j+1);
+  }
+
+  // ID of the k-th live cell
+  inline index_t live_cell(index_t k) {
+    return live_cells ? live_cells[k] : k/NGRID + (k%NGRID)*NGRID;
+  }
+
+  // Coordinates of cell ID, like getCellCoords (but with a mask and a shift
+  // if NGRID is a power of two, when POW2 must be set)
+  template<bool POW2>
+  inline void cell_coords (index_t ID, int &x, int &y) {
+    if (POW2) {
+      x = ID & (NGRID-1);
+      y = ID >> NGRID_SHIFT;
+    } else {
+      x = ID % NGRID;
+      y = ID / NGRID;
+    }
+  }
+
+  // Coordinates of the k-th live cell, like cell_coords(live_cell(k),...)
+  template<bool POW2>
+  inline void live_coords (index_t k, int &x, int &y) {
+    if (live_cells) {
+      cell_coords<POW2>(live_cells[k], x, y);
+    } else if (POW2) {
+      x = k >> NGRID_SHIFT;
+      y = k & (NGRID-1);
+    } else {
+      x = k / NGRID;
+      y = k % NGRID;
+    }
+  }
+
+  // Returns the energy of the cell at index idx of the padded lattice
+  // Spins are read from the given lattice (grid or grid_copy). Thanks to the
+  // halo no wraparound checks are needed, and since dead cells have spin 0
+  // they need no checks either.
+  inline int compute_energy_site (index_t idx, const spin_t* _grid) {
+    int neigh_sum = _grid[idx+STRIDE] + _grid[idx-STRIDE] + _grid[idx+1] + _grid[idx-1];
+    return -_grid[idx] * neigh_sum;
+  }
+
+  // Spin of cell (i,j)
+  inline int get_spin(int i, int j) {
+    return grid[site(i,j)];
+  }
+
+  // Sets the spin of cell (i,j), keeping the halo in sync
+  inline void set_spin(int i, int j, int s) {
+    grid[site(i,j)] = s;
+    if (i == 0 || i == NGRID-1 || j == 0 || j == NGRID-1) {
+      sync_halo_cell(grid, i, j);
+    }
+  }
+
+  // Copies the edges of a padded lattice into its halo
+  template<typename TYPE>
+  void sync_halo (TYPE* lat) {
+    int i;
+    for (i = 0; i < NGRID; i++) {
+      lat[site(i,-1)] = lat[site(i,NGRID-1)];
+      lat[site(i,NGRID)] = lat[site(i,0)];
+    }
+    for (i = 0; i < NGRID; i++) {
+      lat[site(-1,i)] = lat[site(NGRID-1,i)];
+      lat[site(NGRID,i)] = lat[site(0,i)];
+    }
+  }
+
+  // Copies edge cell (i,j) of a padded lattice into its halo image(s)
+  template<typename TYPE>
+  void sync_halo_cell (TYPE* lat, int i, int j) {
+    TYPE val = lat[site(i,j)];
+    if (i == 0) lat[site(NGRID,j)] = val;
+    if (i == NGRID-1) lat[site(-1,j)] = val;
+    if (j == 0) lat[site(i,NGRID)] = val;
+    if (j == NGRID-1) lat[site(i,-1)] = val;
+  }
 
 };
 
@@ -0,0 +1,363 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <immintrin.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "IsingModel.h"
+
+/*============================================================================*/
+
+/*======================================\\
+|| Vectorized checkerboard sweep kernel ||
+\\======================================*/
+
+// The kernels below are compiled for AVX2 and AVX-512 through function
+// target attributes, so the rest of the code needs no special flags. The
+// instruction set is detected at runtime (see detect_simd).
+
+// Each call updates the cells of one color in one grid row. A vector covers
+// consecutive cells of the row (8 with AVX2, 16 with AVX-512); lanes of the
+// other color are masked out. If NGRID is not a multiple of the vector
+// width, the last vector is aligned with the end of the row and the lanes
+// already covered by the previous one are masked out too, so that no access
+// leaves the row (or its halo).
+
+// Random numbers come from one xoshiro128** generator per lane, stored as
+// rng[k*SIMD_LANES + lane] for state words k=0..3.
+
+/*============================================================================*/
+
+// Per-thread helpers
+
+static inline int thread_num () {
+#ifdef _OPENMP
+  return omp_get_thread_num();
+#else
+  return 0;
+#endif
+}
+
+static inline int max_threads () {
+#ifdef _OPENMP
+  return omp_get_max_threads();
+#else
+  return 1;
+#endif
+}
+
+/*============================================================================*/
+
+/* AVX2 KERNEL */
+
+__attribute__((target("avx2")))
+static inline __m256i rotl_avx2 (__m256i x, int k) {
+  return _mm256_or_si256(_mm256_slli_epi32(x, k), _mm256_srli_epi32(x, 32-k));
+}
+
+// Advances 8 xoshiro128** generators and returns their 32-bit outputs
+__attribute__((target("avx2")))
+static inline __m256i next_avx2 (__m256i& s0, __m256i& s1, __m256i& s2, __m256i& s3) {
+  __m256i x5 = _mm256_add_epi32(_mm256_slli_epi32(s1, 2), s1);
+  __m256i r = rotl_avx2(x5, 7);
+  __m256i result = _mm256_add_epi32(_mm256_slli_epi32(r, 3), r);
+  __m256i t = _mm256_slli_epi32(s1, 9);
+  s2 = _mm256_xor_si256(s2, s0);
+  s3 = _mm256_xor_si256(s3, s1);
+  s1 = _mm256_xor_si256(s1, s2);
+  s0 = _mm256_xor_si256(s0, s3);
+  s2 = _mm256_xor_si256(s2, t);
+  s3 = rotl_avx2(s3, 11);
+  return result;
+}
+
+// Loads 8 spins and widens them to 32 bits
+__attribute__((target("avx2")))
+static inline __m256i load_spins_avx2 (const spin_t* p) {
+  return _mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i*) p));
+}
+
+__attribute__((target("avx2")))
+static void sweep_row_avx2 (IsingModel* m, int i, int color, uint32_t* rng, int64_t& dE, int64_t& dM) {
+
+  const int W = 8;
+  const int N = m->NGRID;
+  const int S = m->STRIDE;
+  spin_t* row = &m->grid[m->site(i,0)];
+  int j, first;
+
+  __m256i s0 = _mm256_load_si256((__m256i*) &rng[0*IsingModel::SIMD_LANES]);
+  __m256i s1 = _mm256_load_si256((__m256i*) &rng[1*IsingModel::SIMD_LANES]);
+  __m256i s2 = _mm256_load_si256((__m256i*) &rng[2*IsingModel::SIMD_LANES]);
+  __m256i s3 = _mm256_load_si256((__m256i*) &rng[3*IsingModel::SIMD_LANES]);
+
+  // Thresholds for index prod+4 = 0..7, and for index 8
+  const __m256i thr_lo = _mm256_loadu_si256((const __m256i*) &m->simd_thresh[0]);
+  const __m256i thr_8 = _mm256_set1_epi32(m->simd_thresh[8]);
+  const __m256i four = _mm256_set1_epi32(4);
+  const __m256i eight = _mm256_set1_epi32(8);
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  const __m256i pack_idx = _mm256_setr_epi32(0, 4, 0, 4, 0, 4, 0, 4);
+
+  // Lanes of the current color (all vectors start at an even column)
+  const __m256i parity = _mm256_cmpeq_epi32(
+    _mm256_and_si256(lanes, _mm256_set1_epi32(1)), _mm256_set1_epi32((i+color)%2));
+
+  __m256i dEv = zero;
+  __m256i dMv = zero;
+#ifdef ISING_INSTRUMENT
+  uint64_t flips = 0;
+#endif
+
+  for (j = 0; j < N; j += W) {
+
+    // Realign the last vector with the end of the row if needed
+    first = 0;
+    if (j+W > N) {
+      first = j+W-N;
+      j = N-W;
+    }
+
+    // Neighbor sum, and prod = s*sum = deltaE/2
+    __m256i s = load_spins_avx2(&row[j]);
+    __m256i sum = _mm256_add_epi32(
+      _mm256_add_epi32(load_spins_avx2(&row[j-S]), load_spins_avx2(&row[j+S])),
+      _mm256_add_epi32(load_spins_avx2(&row[j-1]), load_spins_avx2(&row[j+1])));
+    __m256i prod = _mm256_sign_epi32(sum, s);
+
+    // Look up thresholds and roll the dice (31-bit uniforms)
+    __m256i idx = _mm256_add_epi32(prod, four);
+    __m256i thr = _mm256_permutevar8x32_epi32(thr_lo, idx);
+    thr = _mm256_blendv_epi8(thr, thr_8, _mm256_cmpeq_epi32(idx, eight));
+    __m256i u = _mm256_srli_epi32(next_avx2(s0, s1, s2, s3), 1);
+    __m256i flip = _mm256_andnot_si256(_mm256_cmpgt_epi32(u, thr), parity);
+    flip = _mm256_and_si256(flip, _mm256_cmpgt_epi32(lanes, _mm256_set1_epi32(first-1)));
+#ifdef ISING_INSTRUMENT
+    flips += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(
+      _mm256_andnot_si256(_mm256_cmpeq_epi32(s, zero), flip))));
+#endif
+
+    // Accumulate energy and magnetization changes
+    dEv = _mm256_add_epi32(dEv, _mm256_and_si256(flip, _mm256_add_epi32(prod, prod)));
+    __m256i neg = _mm256_sub_epi32(zero, s);
+    dMv = _mm256_add_epi32(dMv, _mm256_and_si256(flip, _mm256_add_epi32(neg, neg)));
+
+    // Flip and store back (narrowing to 8 bits)
+    __m256i snew = _mm256_blendv_epi8(s, neg, flip);
+    snew = _mm256_packs_epi32(snew, snew);
+    snew = _mm256_packs_epi16(snew, snew);
+    snew = _mm256_permutevar8x32_epi32(snew, pack_idx);
+    _mm_storel_epi64((__m128i*) &row[j], _mm256_castsi256_si128(snew));
+
+  }
+
+  _mm256_store_si256((__m256i*) &rng[0*IsingModel::SIMD_LANES], s0);
+  _mm256_store_si256((__m256i*) &rng[1*IsingModel::SIMD_LANES], s1);
+  _mm256_store_si256((__m256i*) &rng[2*IsingModel::SIMD_LANES], s2);
+  _mm256_store_si256((__m256i*) &rng[3*IsingModel::SIMD_LANES], s3);
+
+  // Horizontal sums
+  int buf[8];
+  _mm256_storeu_si256((__m256i*) buf, dEv);
+  for (j = 0; j < W; j++) dE += buf[j];
+  _mm256_storeu_si256((__m256i*) buf, dMv);
+  for (j = 0; j < W; j++) dM += buf[j];
+#ifdef ISING_INSTRUMENT
+  #pragma omp atomic
+  m->counters.bulk_accepts += flips;
+#endif
+
+}
+
+/*============================================================================*/
+
+/* AVX-512 KERNEL */
+
+// Advances 16 xoshiro128** generators and returns their 32-bit outputs
+__attribute__((target("avx512f")))
+static inline __m512i next_avx512 (__m512i& s0, __m512i& s1, __m512i& s2, __m512i& s3) {
+  __m512i x5 = _mm512_add_epi32(_mm512_slli_epi32(s1, 2), s1);
+  __m512i r = _mm512_rol_epi32(x5, 7);
+  __m512i result = _mm512_add_epi32(_mm512_slli_epi32(r, 3), r);
+  __m512i t = _mm512_slli_epi32(s1, 9);
+  s2 = _mm512_xor_si512(s2, s0);
+  s3 = _mm512_xor_si512(s3, s1);
+  s1 = _mm512_xor_si512(s1, s2);
+  s0 = _mm512_xor_si512(s0, s3);
+  s2 = _mm512_xor_si512(s2, t);
+  s3 = _mm512_rol_epi32(s3, 11);
+  return result;
+}
+
+// Loads 16 spins and widens them to 32 bits
+__attribute__((target("avx512f")))
+static inline __m512i load_spins_avx512 (const spin_t* p) {
+  return _mm512_cvtepi8_epi32(_mm_loadu_si128((const __m128i*) p));
+}
+
+__attribute__((target("avx512f")))
+static void sweep_row_avx512 (IsingModel* m, int i, int color, uint32_t* rng, int64_t& dE, int64_t& dM) {
+
+  const int W = 16;
+  const int N = m->NGRID;
+  const int S = m->STRIDE;
+  spin_t* row = &m->grid[m->site(i,0)];
+  int j;
+
+  __m512i s0 = _mm512_load_si512(&rng[0*IsingModel::SIMD_LANES]);
+  __m512i s1 = _mm512_load_si512(&rng[1*IsingModel::SIMD_LANES]);
+  __m512i s2 = _mm512_load_si512(&rng[2*IsingModel::SIMD_LANES]);
+  __m512i s3 = _mm512_load_si512(&rng[3*IsingModel::SIMD_LANES]);
+
+  const __m512i thr_tab = _mm512_loadu_si512(m->simd_thresh);
+  const __m512i four = _mm512_set1_epi32(4);
+  const __m512i zero = _mm512_setzero_si512();
+
+  // Lanes of the current color (all vectors start at an even column)
+  const __mmask16 parity = ((i+color)%2 == 0) ? 0x5555 : 0xAAAA;
+
+  __m512i dEv = zero;
+  __m512i dMv = zero;
+#ifdef ISING_INSTRUMENT
+  uint64_t flips = 0;
+#endif
+
+  for (j = 0; j < N; j += W) {
+
+    // Realign the last vector with the end of the row if needed
+    __mmask16 valid = parity;
+    if (j+W > N) {
+      valid &= (__mmask16) (0xFFFF << (j+W-N));
+      j = N-W;
+    }
+
+    // Neighbor sum, and prod = s*sum = deltaE/2
+    __m512i s = load_spins_avx512(&row[j]);
+    __m512i sum = _mm512_add_epi32(
+      _mm512_add_epi32(load_spins_avx512(&row[j-S]), load_spins_avx512(&row[j+S])),
+      _mm512_add_epi32(load_spins_avx512(&row[j-1]), load_spins_avx512(&row[j+1])));
+    __m512i prod = _mm512_mullo_epi32(sum, s);
+
+    // Look up thresholds and roll the dice (31-bit uniforms)
+    __m512i thr = _mm512_permutexvar_epi32(_mm512_add_epi32(prod, four), thr_tab);
+    __m512i u = _mm512_srli_epi32(next_avx512(s0, s1, s2, s3), 1);
+    __mmask16 flip = _mm512_mask_cmple_epi32_mask(valid, u, thr);
+#ifdef ISING_INSTRUMENT
+    flips += __builtin_popcount(_mm512_test_epi32_mask(s, s) & flip);
+#endif
+
+    // Accumulate energy and magnetization changes
+    __m512i neg = _mm512_sub_epi32(zero, s);
+    dEv = _mm512_mask_add_epi32(dEv, flip, dEv, _mm512_add_epi32(prod, prod));
+    dMv = _mm512_mask_add_epi32(dMv, flip, dMv, _mm512_add_epi32(neg, neg));
+
+    // Store only the flipped spins
+    _mm512_mask_cvtepi32_storeu_epi8(&row[j], flip, neg);
+
+  }
+
+  _mm512_store_si512(&rng[0*IsingModel::SIMD_LANES], s0);
+  _mm512_store_si512(&rng[1*IsingModel::SIMD_LANES], s1);
+  _mm512_store_si512(&rng[2*IsingModel::SIMD_LANES], s2);
+  _mm512_store_si512(&rng[3*IsingModel::SIMD_LANES], s3);
+
+  dE += _mm512_reduce_add_epi32(dEv);
+  dM += _mm512_reduce_add_epi32(dMv);
+#ifdef ISING_INSTRUMENT
+  #pragma omp atomic
+  m->counters.bulk_accepts += flips;
+#endif
+
+}
+
+/*============================================================================*/
+
+// Returns the best vector instruction set supported by the CPU
+int IsingModel::detect_simd () {
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) return SIMD_AVX512;
+  if (__builtin_cpu_supports("avx2")) return SIMD_AVX2;
+  return SIMD_NONE;
+}
+
+/*============================================================================*/
+
+// Does a checkerboard sweep of the grid using the vector kernels
+// The rows are processed in four phases (cell color x row parity), each
+// distributed among OpenMP threads: within a phase no thread touches a row
+// that another one reads, and the halo is synchronized between phases.
+// Falls back to the scalar checkerboardSweep when no vector instruction set
+// is available (or simd_isa is set to SIMD_NONE), or when NGRID is odd or
+// smaller than the vector width. Dead cells (spin 0) need no special
+// handling: their neighbor sums and spin changes are all 0.
+void IsingModel::simdSweep () {
+
+  int color, rowpar, i, s, isa;
+  int64_t dE, dM;
+  void (*kernel)(IsingModel*, int, int, uint32_t*, int64_t&, int64_t&);
+
+  // Choose kernel
+  isa = simd_isa;
+  if (isa == SIMD_AVX512 && NGRID < 16) isa = SIMD_AVX2;
+  if (isa == SIMD_AVX2 && NGRID < 8) isa = SIMD_NONE;
+  if (isa == SIMD_NONE || NGRID%2 != 0) {
+    checkerboardSweep();
+    return;
+  }
+  if (isa == SIMD_AVX512) {
+    kernel = sweep_row_avx512;
+  } else {
+    kernel = sweep_row_avx2;
+  }
+
+  // Make sure there is a generator state for every thread
+  if (num_simd_rng < max_threads()) {
+    free(simd_rng);
+    num_simd_rng = max_threads();
+    simd_rng = (uint32_t*) aligned_alloc(LATTICE_ALIGN, num_simd_rng*SIMD_RNG_WORDS*sizeof(uint32_t));
+    for (i = 0; i < num_simd_rng; i++) {
+      IsingRNG seeder;
+      seeder.seed(seed, SIMD_STREAM + i);
+      for (int k = 0; k < SIMD_RNG_WORDS; k++) {
+        simd_rng[i*SIMD_RNG_WORDS + k] = seeder.next_u32() | 1;
+      }
+    }
+  }
+
+  dE = 0;
+  dM = 0;
+  for (color = 0; color < 2; color++) {
+    for (rowpar = 0; rowpar < 2; rowpar++) {
+      #pragma omp parallel reduction(+:dE,dM)
+      {
+        uint32_t* rng = &simd_rng[thread_num()*SIMD_RNG_WORDS];
+        #pragma omp for schedule(static)
+        for (i = rowpar; i < NGRID; i += 2) {
+          kernel(this, i, color, rng, dE, dM);
+        }
+      }
+      sync_halo(grid);
+    }
+  }
+
+#ifdef ISING_INSTRUMENT
+  // The kernels count the accepted flips of the live cells
+  counters.bulk_attempts += NLIVE;
+#endif
+
+  // Update global energy and magnetization
+  global_energy += dE;
+  global_magnetization += dM/(double)(NCELLS);
+
+  // Recompute sample magnetizations, rather than tracking them per flip
+  if (track_samples) {
+    for (s = 0; s < NUM_SAMPLES; s++) {
+      update_sample_magn(s);
+    }
+  }
+
+}
+
+/*============================================================================*/
@@ -0,0 +1,350 @@
+#include <stdio.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "IsingModel.h"
+#include "MSCIsingModel.h"
+#include "Checkpoint.h"
+
+/*============================================================================*/
+
+/*=====================================================\\
+|| Multi-spin-coded Ising Model engine implementation ||
+\\=====================================================*/
+
+/*============================================================================*/
+
+// Bit masks of the even and odd bit positions of a word
+static const uint64_t EVEN_BITS = 0x5555555555555555ULL;
+static const uint64_t ODD_BITS = 0xAAAAAAAAAAAAAAAAULL;
+
+/*============================================================================*/
+
+// Constructor
+// Grid size (must be even) and temperature must be provided.
+MSCIsingModel::MSCIsingModel (int p_NGRID, double p_TEMP) {
+
+  TEMP = p_TEMP;
+  NGRID = p_NGRID;
+  NCELLS = NGRID*NGRID;
+  NWORDS = (NGRID+63)/64;
+  if (NGRID%64 == 0) {
+    last_mask = ~0ULL;
+  } else {
+    last_mask = (1ULL << (NGRID%64)) - 1;
+  }
+  START_GEN = 1;
+
+  if (NGRID%2 != 0) {
+    fprintf(stderr, "MSCIsingModel: NGRID must be even (got %i)\n", NGRID);
+    exit(1);
+  }
+
+  // Allocate the packed grid (all spins down)
+  words = (uint64_t*) calloc(NGRID*NWORDS, sizeof(uint64_t));
+
+  trans_dynamics = IsingModel::DYNAMICS_METROPOLIS;
+  update_acceptance();
+
+  reset_stats();
+  cur_gen = 0;
+
+  // Seed RNG (the user may reseed with setSeed)
+  setSeed(time(NULL));
+
+}
+
+/*============================================================================*/
+
+// Destructor
+MSCIsingModel::~MSCIsingModel () {
+  free(words);
+}
+
+/*============================================================================*/
+
+// Reset all stats
+void MSCIsingModel::reset_stats () {
+  global_energy = 0;
+  global_magnetization = 0.0;
+  global_mean = 0.0;
+  global_variance = 0.0;
+  global_npoints = 0;
+  equil.reset();
+  global_M2 = 0;
+  spin_sum = 0;
+}
+
+/*============================================================================*/
+
+// Tabulates the flip acceptance probabilities for the current temperature
+// and dynamics, indexed by the number k of anti-aligned neighbors. The energy
+// change of the flip is deltaE = 8-4k, and the probability is:
+// DYNAMICS_METROPOLIS: 1 if deltaE <= 0, e^(-deltaE/T) otherwise
+// DYNAMICS_GLAUBER: 1/(1 + e^(deltaE/T))
+void MSCIsingModel::update_acceptance () {
+  int k, deltaE;
+  double prob;
+  for (k = 0; k <= 4; k++) {
+    deltaE = 8 - 4*k;
+    if (trans_dynamics == IsingModel::DYNAMICS_GLAUBER) {
+      prob = 1/(1 + exp(deltaE/TEMP));
+    } else {
+      if (deltaE <= 0) prob = 1.0;
+      else prob = exp(-deltaE/TEMP);
+    }
+    if (prob >= 1.0) {
+      accept_prob[k] = ACCEPT_ALWAYS;
+    } else {
+      accept_prob[k] = (uint64_t) floor(prob*4294967296.0);
+    }
+  }
+  table_temp = TEMP;
+  table_dynamics = trans_dynamics;
+}
+
+/*============================================================================*/
+
+// Sets the temperature and updates the acceptance table
+void MSCIsingModel::setTemperature (double p_TEMP) {
+  TEMP = p_TEMP;
+  update_acceptance();
+}
+
+/*============================================================================*/
+
+// Sets the transition dynamics and updates the acceptance table
+void MSCIsingModel::setDynamics (int p_dynamics) {
+  if (p_dynamics != IsingModel::DYNAMICS_METROPOLIS &&
+      p_dynamics != IsingModel::DYNAMICS_GLAUBER) {
+    fprintf(stderr, "MSCIsingModel: only Metropolis and Glauber dynamics supported\n");
+    exit(1);
+  }
+  trans_dynamics = p_dynamics;
+  update_acceptance();
+}
+
+/*============================================================================*/
+
+// Sets spins to get a global magnetization close to the given value
+// (see IsingModel::set_magnetization)
+void MSCIsingModel::set_magnetization (double magn) {
+  int i, j;
+  uint64_t* row;
+  double p = (magn+1)/2.0;
+  for (i = 0; i < NGRID; i++) {
+    row = &words[i*NWORDS];
+    memset(row, 0, NWORDS*sizeof(uint64_t));
+    for (j = 0; j < NGRID; j++) {
+      if (rng.uniform() < p){
+        row[j/64] |= 1ULL << (j%64);
+      }
+    }
+  }
+  update_magnetization();
+}
+
+/*============================================================================*/
+
+// Computes the current global energy of the grid
+// Every right and down bond contributes -1 if aligned and +1 otherwise.
+void MSCIsingModel::update_energy () {
+  int i, w, anti;
+  uint64_t mask;
+  const uint64_t *row, *down;
+  anti = 0;
+  for (i = 0; i < NGRID; i++) {
+    row = &words[i*NWORDS];
+    down = &words[((i+1)%NGRID)*NWORDS];
+    for (w = 0; w < NWORDS; w++) {
+      mask = (w == NWORDS-1) ? last_mask : ~0ULL;
+      anti += __builtin_popcountll((row[w] ^ right_word(row, w)) & mask);
+      anti += __builtin_popcountll((row[w] ^ down[w]) & mask);
+    }
+  }
+  global_energy = 2*anti - 2*NCELLS;
+}
+
+/*============================================================================*/
+
+// Computes the current global magnetization of the grid
+void MSCIsingModel::update_magnetization () {
+  int i, up;
+  up = 0;
+  for (i = 0; i < NGRID*NWORDS; i++) {
+    up += __builtin_popcountll(words[i]);
+  }
+  spin_sum = 2*up - NCELLS;
+  global_magnetization = spin_sum/(double)(NCELLS);
+}
+
+/*============================================================================*/
+
+// Reseeds the random number generator
+void MSCIsingModel::setSeed (uint64_t p_seed) {
+  seed = p_seed;
+  rng.seed(seed, 0);
+}
+
+/*============================================================================*/
+
+// Saves the full state of the model to a checkpoint file
+// (see IsingModel::saveCheckpoint)
+bool MSCIsingModel::saveCheckpoint (const char* fname) {
+  CheckpointWriter ckp;
+  ckp.open(fname, "MSC1");
+  ckp.put(NGRID);
+  ckp.put(TEMP);
+  ckp.put(trans_dynamics);
+  ckp.put(START_GEN);
+  ckp.put(cur_gen);
+  ckp.put_array(words, NGRID*NWORDS);
+  ckp.put(global_energy);
+  ckp.put(global_magnetization);
+  ckp.put(global_mean);
+  ckp.put(global_variance);
+  ckp.put(global_M2);
+  ckp.put(global_npoints);
+  ckp.put(equil);
+  ckp.put(spin_sum);
+  ckp.put(seed);
+  ckp.put(rng);
+  return ckp.close();
+}
+
+/*============================================================================*/
+
+// Restores the full state of the model from a checkpoint written by
+// saveCheckpoint (see IsingModel::loadCheckpoint)
+bool MSCIsingModel::loadCheckpoint (const char* fname) {
+  CheckpointReader ckp;
+  if (!ckp.open(fname, "MSC1")) return ckp.close();
+  ckp.expect(NGRID);
+  if (!ckp.ok) return ckp.close();
+  ckp.get(TEMP);
+  ckp.get(trans_dynamics);
+  ckp.get(START_GEN);
+  ckp.get(cur_gen);
+  ckp.get_array(words, NGRID*NWORDS);
+  ckp.get(global_energy);
+  ckp.get(global_magnetization);
+  ckp.get(global_mean);
+  ckp.get(global_variance);
+  ckp.get(global_M2);
+  ckp.get(global_npoints);
+  ckp.get(equil);
+  ckp.get(spin_sum);
+  ckp.get(seed);
+  ckp.get(rng);
+  update_acceptance();
+  return ckp.close();
+}
+
+/*============================================================================*/
+
+// Advances the grid by one generation (one attempted flip per cell)
+// The cells are updated as a checkerboard: first all cells with i+j even,
+// then all with i+j odd. Within a word, the number of anti-aligned neighbors
+// of each cell is obtained with a bit-sliced adder, and every class k of
+// cells is flipped with its own acceptance probability.
+void MSCIsingModel::doGeneration () {
+
+  int color, i, w, k;
+  int dE, dM;
+  uint64_t *row;
+  const uint64_t *up, *down;
+  uint64_t s, a1, a2, a3, a4, s1, c1, s2, c2, carry, ones, twos, fours;
+  uint64_t todo, cls, flip;
+
+  // Rebuild the acceptance table if TEMP or trans_dynamics were modified
+  if (TEMP != table_temp || trans_dynamics != table_dynamics) {
+    update_acceptance();
+  }
+
+  dE = 0;
+  dM = 0;
+  for (color = 0; color < 2; color++) {
+    for (i = 0; i < NGRID; i++) {
+      row = &words[i*NWORDS];
+      up = &words[((i+NGRID-1)%NGRID)*NWORDS];
+      down = &words[((i+1)%NGRID)*NWORDS];
+      for (w = 0; w < NWORDS; w++) {
+
+        // Cells of the current color in this word
+        todo = ((i+color)%2 == 0) ? EVEN_BITS : ODD_BITS;
+        if (w == NWORDS-1) todo &= last_mask;
+
+        // Anti-aligned neighbor flags
+        s = row[w];
+        a1 = s ^ up[w];
+        a2 = s ^ down[w];
+        a3 = s ^ left_word(row, w);
+        a4 = s ^ right_word(row, w);
+
+        // Bit-sliced count k = a1+a2+a3+a4 = ones + 2*twos + 4*fours
+        s1 = a1 ^ a2;
+        c1 = a1 & a2;
+        s2 = a3 ^ a4;
+        c2 = a3 & a4;
+        ones = s1 ^ s2;
+        carry = s1 & s2;
+        twos = c1 ^ c2 ^ carry;
+        fours = (c1 & c2) | ((c1 ^ c2) & carry);
+
+        // Accept flips class by class
+        flip = 0;
+        for (k = 0; k <= 4; k++) {
+          switch (k) {
+            case 0: cls = ~ones & ~twos & ~fours; break;
+            case 1: cls = ones & ~twos & ~fours; break;
+            case 2: cls = ~ones & twos; break;
+            case 3: cls = ones & twos; break;
+            default: cls = fours; break;
+          }
+          cls &= todo;
+          if (!cls) continue;
+          cls = rng.bernoulli_word(accept_prob[k], cls);
+          flip |= cls;
+          dE += (8 - 4*k)*__builtin_popcountll(cls);
+        }
+
+        // Flip and update magnetization
+        dM += 2*(__builtin_popcountll(flip & ~s) - __builtin_popcountll(flip & s));
+        row[w] = s ^ flip;
+
+      }
+    }
+  }
+
+  global_energy += dE;
+  spin_sum += dM;
+  global_magnetization = spin_sum/(double)(NCELLS);
+
+  // Update stats
+  cur_gen++;
+  if (cur_gen>=START_GEN) {
+    update_stats();
+  }
+
+}
+
+/*============================================================================*/
+
+// Updates the global mean and variance of the magnetization
+// (see IsingModel::update_stats)
+void MSCIsingModel::update_stats () {
+  double delta;
+  global_npoints++;
+  delta = global_magnetization - global_mean;
+  global_mean = global_mean + delta/global_npoints;
+  global_M2 = global_M2 + delta*(global_magnetization - global_mean);
+  if (global_npoints==1) {
+    global_variance = 0.0;
+  } else {
+    global_variance = global_M2/(global_npoints-1);
+  }
+  equil.add(cur_gen, global_magnetization, global_energy/(double)NCELLS);
+}
+
+/*============================================================================*/
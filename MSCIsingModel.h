@@ -0,0 +1,126 @@
+#ifndef MSC_ISING_H
+#define MSC_ISING_H
+
+#include <stdint.h>
+#include "Random.h"
+#include "Binning.h"
+
+/*====================================================\\
+|| Multi-spin-coded Ising Model engine declaration    ||
+\\====================================================*/
+
+// Alternative engine for the plain (undiluted) 2D nearest-neighbor model that
+// stores 64 spins per machine word and updates a whole word at once using
+// bitwise logic. It exposes the same basic interface as IsingModel
+// (doGeneration, global_energy, global_magnetization, ...) so that drivers
+// can switch engines at startup.
+// Only checkerboard updates are possible, so NGRID must be even. Dead cells
+// and sample statistics are not supported.
+
+class MSCIsingModel {
+
+  public:
+
+  /*==========================================================================*/
+
+  /* MEMBER VARIABLES */
+
+  // Temperature, in units of J/k
+  double TEMP;
+
+  // Size of grid (NGRID x NGRID)
+  // At most MAX_NGRID: the cell counts and energy sums are int, and the
+  // count of anti-aligned bonds reaches 4*NCELLS in the energy.
+  static const int MAX_NGRID = 23170;
+  int NGRID;
+
+  // Total number of cells, equal to NGRID*NGRID
+  int NCELLS;
+
+  // Number of words per grid row, equal to ceil(NGRID/64)
+  int NWORDS;
+
+  // Mask of the valid bits of the last word of each row
+  uint64_t last_mask;
+
+  // Bit-packed spin states
+  // Bit b of word w in row i holds cell (i, 64*w+b); a set bit is spin +1.
+  // Unused bits of the last word in each row are always zero.
+  // words[NGRID*NWORDS]
+  uint64_t* words;
+
+  // Dynamics, one of IsingModel::DYNAMICS_METROPOLIS or DYNAMICS_GLAUBER
+  int trans_dynamics;
+
+  // Flip acceptance probabilities as 32-bit fixed point numbers, indexed by
+  // the number k of anti-aligned neighbors (deltaE = 8-4k)
+  // A value of ACCEPT_ALWAYS means the flip is certain (see
+  // IsingRNG::bernoulli_word).
+  static const uint64_t ACCEPT_ALWAYS = 1ULL << 32;
+  uint64_t accept_prob[5];
+  double table_temp;
+  int table_dynamics;
+
+  // Random number generator and its seed
+  uint64_t seed;
+  IsingRNG rng;
+
+  // Current generation (will never reset)
+  int cur_gen;
+
+  // Generation in which to start recording stats
+  int START_GEN;
+
+  // Global statistics
+  int global_energy;
+  double global_magnetization;
+  double global_mean;
+  double global_variance;
+  double global_M2;
+  int global_npoints;
+
+  // Equilibration and error analysis of |M| and E (see IsingModel)
+  EquilibriumStats equil;
+
+  // Sum of all spins, from which global_magnetization is derived
+  int spin_sum;
+
+  /*==========================================================================*/
+
+  /* MEMBER FUNCTIONS */
+
+  MSCIsingModel(int, double);
+  ~MSCIsingModel();
+  void reset_stats();
+  void update_acceptance();
+  void setTemperature(double);
+  void setDynamics(int);
+  void set_magnetization(double);
+  void update_energy();
+  void update_magnetization();
+  void doGeneration();
+  void update_stats();
+  void setSeed(uint64_t);
+  bool saveCheckpoint(const char*);
+  bool loadCheckpoint(const char*);
+
+  // Spin of cell (i,j)
+  inline int get_spin(int i, int j) {
+    return ((words[i*NWORDS + j/64] >> (j%64)) & 1) ? +1 : -1;
+  }
+
+  // Word holding the left (j-1) neighbors of the cells in word w of a row
+  inline uint64_t left_word(const uint64_t* row, int w) {
+    if (w > 0) return (row[w] << 1) | (row[w-1] >> 63);
+    return (row[0] << 1) | ((row[NWORDS-1] >> ((NGRID-1)%64)) & 1);
+  }
+
+  // Word holding the right (j+1) neighbors of the cells in word w of a row
+  inline uint64_t right_word(const uint64_t* row, int w) {
+    if (w < NWORDS-1) return (row[w] >> 1) | (row[w+1] << 63);
+    return (row[w] >> 1) | ((row[0] & 1) << ((NGRID-1)%64));
+  }
+
+};
+
+#endif // MSC_ISING_H
@@ -0,0 +1,240 @@
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include <stdint.h>
+
+// Fast, seedable pseudo-random number generators.
+
+// Two engines are provided, xoshiro256** (default) and PCG32 (XSH-RR); the
+// one used by the models (IsingRNG) is chosen at compile time by defining
+// ISING_RNG_PCG. Both are small plain structs, so independent copies can be
+// kept per thread (or per replica) and their state saved by copying them.
+
+// Independent streams are obtained by seeding with the same seed and a
+// different stream number: PCG32 has native streams, while xoshiro256** mixes
+// the stream number into its SplitMix64 seeding.
+
+// Implementations are in this header file so that they can be inlined in the
+// hot loops.
+
+/*============================================================================*/
+
+// SplitMix64 finalizer: a stateless hash of x
+// Hashing a key plus a counter gives counter-based random numbers, which
+// don't depend on the order (or thread) in which they are drawn.
+inline uint64_t mix64 (uint64_t z) {
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+// SplitMix64 step: advances x and returns a well-mixed 64-bit value
+inline uint64_t splitmix64 (uint64_t& x) {
+  return mix64(x += 0x9E3779B97F4A7C15ULL);
+}
+
+// 128-bit unsigned integers, a GCC/Clang extension (marked as such so that
+// -pedantic builds accept it)
+__extension__ typedef unsigned __int128 uint128_t;
+
+/*============================================================================*/
+
+/*=====================\
+| xoshiro256** engine |
+\=====================*/
+
+struct Xoshiro256 {
+
+  uint64_t s[4];
+
+  static inline uint64_t rotl (uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
+  }
+
+  void seed (uint64_t seed, uint64_t stream) {
+    uint64_t x = seed ^ splitmix64(stream);
+    for (int i = 0; i < 4; i++) {
+      s[i] = splitmix64(x);
+    }
+  }
+
+  inline uint64_t next_u64 () {
+    uint64_t result = rotl(s[1]*5, 7)*9;
+    uint64_t t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl(s[3], 45);
+    return result;
+  }
+
+  inline uint32_t next_u32 () {
+    return next_u64() >> 32;
+  }
+
+};
+
+/*============================================================================*/
+
+/*=============\
+| PCG32 engine |
+\=============*/
+
+struct Pcg32 {
+
+  uint64_t state;
+  uint64_t inc;
+
+  void seed (uint64_t seed, uint64_t stream) {
+    state = 0;
+    inc = (stream << 1) | 1;
+    next_u32();
+    state += seed;
+    next_u32();
+  }
+
+  inline uint32_t next_u32 () {
+    uint64_t old = state;
+    state = old*6364136223846793005ULL + inc;
+    uint32_t xorshifted = ((old >> 18) ^ old) >> 27;
+    uint32_t rot = old >> 59;
+    return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+  }
+
+  inline uint64_t next_u64 () {
+    uint64_t hi = next_u32();
+    return (hi << 32) | next_u32();
+  }
+
+};
+
+/*============================================================================*/
+
+/*=================================\
+| Generator interface over engines |
+\=================================*/
+
+template<typename ENGINE>
+struct RandomGenerator : public ENGINE {
+
+  // Uniform integer in [0, 2^31), the same range as rand() with glibc
+  inline uint32_t next_u31 () {
+    return this->next_u32() >> 1;
+  }
+
+  // Uniform double in [0, 1)
+  inline double uniform () {
+    return (this->next_u64() >> 11) * (1.0/9007199254740992.0);
+  }
+
+  // Uniform integer in [0, n) (multiply-shift; the bias is below n/2^64)
+  inline uint64_t below (uint64_t n) {
+    return (uint64_t) (((uint128_t) this->next_u64() * n) >> 64);
+  }
+
+  // Fills buf with n uniform integers in [0, 2^31)
+  void fill_u31 (uint32_t* buf, int n) {
+    for (int i = 0; i < n; i++) {
+      buf[i] = next_u31();
+    }
+  }
+
+  // Fills buf with n uniform doubles in [0, 1)
+  void fill_uniform (double* buf, int n) {
+    for (int i = 0; i < n; i++) {
+      buf[i] = uniform();
+    }
+  }
+
+  // Returns a word whose bits are independently set with probability
+  // prob/2^32 (always if prob >= 2^32), computed only for the bits set in
+  // mask (the rest are zero).
+  // Each bit draws a 32-bit uniform U one bit at a time, from the most
+  // significant down, and compares it against prob. A bit is decided as soon
+  // as its U differs from prob, so only a handful of random words are needed.
+  // Used by the multi-spin-coded engines.
+  inline uint64_t bernoulli_word (uint64_t prob, uint64_t mask) {
+    uint64_t result, undecided, x;
+    int t;
+    if (prob >= (1ULL << 32)) return mask;
+    result = 0;
+    undecided = mask;
+    for (t = 31; t >= 0 && undecided; t--) {
+      x = this->next_u64();
+      if ((prob >> t) & 1) {
+        // U < prob wherever this bit of U is 0
+        result |= undecided & ~x;
+        undecided &= x;
+      } else {
+        // U > prob wherever this bit of U is 1
+        undecided &= ~x;
+      }
+    }
+    // Bits still undecided have U == prob: rejected
+    return result;
+  }
+
+};
+
+/*============================================================================*/
+
+/*======================\
+| Random permutations |
+\======================*/
+
+// Pseudorandom permutation of [0, n), evaluated on the fly
+// A balanced Feistel network of FEISTEL_ROUNDS rounds permutes the values of
+// 2*half_bits bits, the fewest covering n; values that land at or above n are
+// passed through the network again until they fall in [0, n) ("cycle
+// walking"), which keeps it a bijection and takes fewer than four passes on
+// average. Every key gives a different permutation, so the models draw a
+// new key each time instead of materializing and shuffling an array of n
+// indices.
+struct FeistelPermutation {
+
+  static const int FEISTEL_ROUNDS = 4;
+
+  uint64_t n;
+  int half_bits;
+  uint64_t half_mask;
+  uint64_t keys[FEISTEL_ROUNDS];
+
+  void init (uint64_t p_n, uint64_t key) {
+    n = p_n;
+    half_bits = 1;
+    while (half_bits < 32 && (1ULL << (2*half_bits)) < n) half_bits++;
+    half_mask = (1ULL << half_bits) - 1;
+    for (int r = 0; r < FEISTEL_ROUNDS; r++) {
+      keys[r] = splitmix64(key);
+    }
+  }
+
+  // Image of x in [0, n)
+  inline uint64_t operator() (uint64_t x) const {
+    uint64_t left, right, tmp;
+    do {
+      left = x >> half_bits;
+      right = x & half_mask;
+      for (int r = 0; r < FEISTEL_ROUNDS; r++) {
+        tmp = right;
+        right = left ^ (mix64(right ^ keys[r]) & half_mask);
+        left = tmp;
+      }
+      x = (left << half_bits) | right;
+    } while (x >= n);
+    return x;
+  }
+
+};
+
+/*============================================================================*/
+
+#ifdef ISING_RNG_PCG
+typedef RandomGenerator<Pcg32> IsingRNG;
+#else
+typedef RandomGenerator<Xoshiro256> IsingRNG;
+#endif
+
+#endif // RANDOM_H
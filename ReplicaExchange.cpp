@@ -0,0 +1,291 @@
+#include <stdio.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "IsingModel.h"
+#include "ReplicaExchange.h"
+
+/*============================================================================*/
+
+/*=======================================\\
+|| Replica exchange class implementation ||
+\\=======================================*/
+
+/*============================================================================*/
+
+// Constructor
+// Grid size, number of temperatures and the temperatures themselves (in
+// increasing order) must be provided. All replicas use the default flip
+// strategy and dynamics of IsingModel.
+ReplicaExchange::ReplicaExchange (int p_NGRID, int p_NUM_REPLICAS, const double* p_temps) {
+
+  int k;
+
+  NUM_REPLICAS = p_NUM_REPLICAS;
+  SWAP_EVERY = 1;
+
+  temps = (double*) malloc(NUM_REPLICAS*sizeof(double));
+  replicas = (IsingModel**) malloc(NUM_REPLICAS*sizeof(IsingModel*));
+  for (k = 0; k < NUM_REPLICAS; k++) {
+    temps[k] = p_temps[k];
+    replicas[k] = new IsingModel(p_NGRID, temps[k]);
+  }
+
+  swap_tries = (int*) malloc(NUM_REPLICAS*sizeof(int));
+  swap_accepts = (int*) malloc(NUM_REPLICAS*sizeof(int));
+  walker = (int*) malloc(NUM_REPLICAS*sizeof(int));
+  walker_dir = (int*) malloc(NUM_REPLICAS*sizeof(int));
+  trip_start = (int*) malloc(NUM_REPLICAS*sizeof(int));
+  round_trips = (int*) malloc(NUM_REPLICAS*sizeof(int));
+  trip_gens = (double*) malloc(NUM_REPLICAS*sizeof(double));
+
+  reset_stats();
+
+  // Seed RNGs (the user may reseed with setSeed)
+  setSeed(time(NULL));
+
+}
+
+/*============================================================================*/
+
+// Destructor
+ReplicaExchange::~ReplicaExchange () {
+  for (int k = 0; k < NUM_REPLICAS; k++) {
+    delete replicas[k];
+  }
+  free(replicas);
+  free(temps);
+  free(swap_tries);
+  free(swap_accepts);
+  free(walker);
+  free(walker_dir);
+  free(trip_start);
+  free(round_trips);
+  free(trip_gens);
+}
+
+/*============================================================================*/
+
+// Reseeds the exchange RNG (stream 0 of the seed) and every replica, with
+// seeds derived from the given one
+void ReplicaExchange::setSeed (uint64_t p_seed) {
+  uint64_t x;
+  seed = p_seed;
+  rng.seed(seed, 0);
+  x = seed;
+  for (int k = 0; k < NUM_REPLICAS; k++) {
+    replicas[k]->setSeed(splitmix64(x));
+  }
+}
+
+/*============================================================================*/
+
+// Sets the transition dynamics of all replicas
+void ReplicaExchange::setDynamics (int p_dynamics) {
+  for (int k = 0; k < NUM_REPLICAS; k++) {
+    replicas[k]->setDynamics(p_dynamics);
+  }
+}
+
+/*============================================================================*/
+
+// Sets the flip strategy of all replicas
+void ReplicaExchange::setFlipStrategy (int p_strategy) {
+  for (int k = 0; k < NUM_REPLICAS; k++) {
+    replicas[k]->flip_strategy = p_strategy;
+  }
+}
+
+/*============================================================================*/
+
+// Randomizes dead cells (see IsingModel::randomizeDead)
+// All replicas get the same dead cells, since configurations are exchanged
+// between them.
+void ReplicaExchange::randomizeDead (double density) {
+  IsingModel* first = replicas[0];
+  first->activateDeadCells();
+  first->randomizeDead(density);
+  for (int k = 1; k < NUM_REPLICAS; k++) {
+    replicas[k]->activateDeadCells();
+    memcpy(replicas[k]->dead_cells, first->dead_cells, first->LATTICE_SIZE*sizeof(bool));
+    replicas[k]->DEAD_DENS = density;
+    replicas[k]->update_dead_cells();
+  }
+}
+
+/*============================================================================*/
+
+// Resets the exchange and round trip statistics, and puts walker k back on
+// replica k
+void ReplicaExchange::reset_stats () {
+  int k;
+  cur_gen = 0;
+  num_swaps = 0;
+  for (k = 0; k < NUM_REPLICAS; k++) {
+    swap_tries[k] = 0;
+    swap_accepts[k] = 0;
+    walker[k] = k;
+    walker_dir[k] = 0;
+    trip_start[k] = 0;
+    round_trips[k] = 0;
+    trip_gens[k] = 0.0;
+  }
+  track_walkers();
+}
+
+/*============================================================================*/
+
+// Advances every replica by one generation, concurrently, and attempts
+// exchanges every SWAP_EVERY generations
+// Each replica runs on a single thread (the multithreaded strategies of the
+// replicas run serially unless nested parallelism is enabled).
+void ReplicaExchange::doGeneration () {
+
+  #pragma omp parallel for schedule(dynamic)
+  for (int k = 0; k < NUM_REPLICAS; k++) {
+    replicas[k]->doGeneration();
+  }
+
+  cur_gen++;
+  if (cur_gen % SWAP_EVERY == 0) {
+    attemptSwaps();
+  }
+
+}
+
+/*============================================================================*/
+
+// Attempts to exchange the configurations of every other pair of neighboring
+// temperatures, alternating between even and odd pairs
+// The exchange between temperatures k and k+1 is accepted with probability
+// min(1, e^((1/T_k - 1/T_k+1)(E_k - E_k+1))).
+void ReplicaExchange::attemptSwaps () {
+
+  int k;
+  double delta;
+
+  for (k = num_swaps%2; k < NUM_REPLICAS-1; k += 2) {
+    delta = (1/temps[k] - 1/temps[k+1])
+            * (replicas[k]->global_energy - replicas[k+1]->global_energy);
+    swap_tries[k]++;
+    if (delta >= 0 || rng.uniform() < exp(delta)) {
+      exchange(k);
+      swap_accepts[k]++;
+    }
+  }
+  num_swaps++;
+
+  track_walkers();
+
+}
+
+/*============================================================================*/
+
+// Exchanges the configurations of replicas k and k+1
+// Only the grid pointers are swapped, along with the global energy and
+// magnetization and the n-fold way index of the grids (which doesn't depend
+// on the temperature); sample magnetizations are recomputed.
+void ReplicaExchange::exchange (int k) {
+
+  IsingModel* a = replicas[k];
+  IsingModel* b = replicas[k+1];
+  spin_t* grid;
+  int w, s, c;
+  int64_t energy;
+  index_t start;
+  index_t* cells;
+  int8_t* cls;
+  bool valid;
+  double magn;
+
+  grid = a->grid; a->grid = b->grid; b->grid = grid;
+  cells = a->nfold_cells; a->nfold_cells = b->nfold_cells; b->nfold_cells = cells;
+  cells = a->nfold_pos; a->nfold_pos = b->nfold_pos; b->nfold_pos = cells;
+  cls = a->nfold_class; a->nfold_class = b->nfold_class; b->nfold_class = cls;
+  for (c = 0; c <= IsingModel::NUM_DELTAE; c++) {
+    start = a->nfold_start[c]; a->nfold_start[c] = b->nfold_start[c]; b->nfold_start[c] = start;
+  }
+  valid = a->nfold_valid; a->nfold_valid = b->nfold_valid; b->nfold_valid = valid;
+  energy = a->global_energy; a->global_energy = b->global_energy; b->global_energy = energy;
+  magn = a->global_magnetization; a->global_magnetization = b->global_magnetization; b->global_magnetization = magn;
+  w = walker[k]; walker[k] = walker[k+1]; walker[k+1] = w;
+
+  if (a->track_samples) {
+    for (s = 0; s < a->NUM_SAMPLES; s++) {
+      a->update_sample_magn(s);
+      b->update_sample_magn(s);
+    }
+  }
+
+}
+
+/*============================================================================*/
+
+// Updates the walker directions and round trips
+// A round trip goes from the lowest temperature to the highest and back.
+void ReplicaExchange::track_walkers () {
+
+  int w;
+
+  // Walker at the lowest temperature
+  w = walker[0];
+  if (walker_dir[w] != +1) {
+    if (walker_dir[w] == -1) {
+      round_trips[w]++;
+      trip_gens[w] += cur_gen - trip_start[w];
+    }
+    walker_dir[w] = +1;
+    trip_start[w] = cur_gen;
+  }
+
+  // Walker at the highest temperature
+  w = walker[NUM_REPLICAS-1];
+  if (walker_dir[w] == +1 && NUM_REPLICAS > 1) {
+    walker_dir[w] = -1;
+  }
+
+}
+
+/*============================================================================*/
+
+// Fraction of accepted exchanges between replicas k and k+1
+double ReplicaExchange::acceptance_rate (int k) {
+  if (swap_tries[k] == 0) return 0.0;
+  return swap_accepts[k]/(double)(swap_tries[k]);
+}
+
+/*============================================================================*/
+
+// Prints the exchange acceptance rates and the round trip statistics
+void ReplicaExchange::report () {
+
+  int k, w, trips;
+  double gens;
+
+  printf("Exchange acceptance rates:\n");
+  for (k = 0; k < NUM_REPLICAS-1; k++) {
+    printf("  T=%.4f <-> T=%.4f: %.3f (%i/%i)\n", temps[k], temps[k+1],
+           acceptance_rate(k), swap_accepts[k], swap_tries[k]);
+  }
+
+  printf("Round trips (lowest -> highest -> lowest T):\n");
+  trips = 0;
+  gens = 0.0;
+  for (w = 0; w < NUM_REPLICAS; w++) {
+    if (round_trips[w] > 0) {
+      printf("  walker %i: %i trips, mean %.1f generations\n", w,
+             round_trips[w], trip_gens[w]/round_trips[w]);
+    } else {
+      printf("  walker %i: no trips\n", w);
+    }
+    trips += round_trips[w];
+    gens += trip_gens[w];
+  }
+  if (trips > 0) {
+    printf("  total: %i trips, mean %.1f generations\n", trips, gens/trips);
+  }
+
+}
+
+/*============================================================================*/
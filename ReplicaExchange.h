@@ -0,0 +1,94 @@
+#ifndef REPLICA_EXCHANGE_H
+#define REPLICA_EXCHANGE_H
+
+#include <stdint.h>
+#include "IsingModel.h"
+#include "Random.h"
+
+/*====================================\\
+|| Replica exchange class declaration ||
+\\====================================*/
+
+// Parallel tempering driver: holds one IsingModel per temperature, advances
+// all of them concurrently (one OpenMP thread per replica), and periodically
+// attempts to exchange the configurations of neighboring temperatures with
+// the usual Metropolis criterion on their energies.
+// Configurations, not temperatures, are exchanged, so replica k is always at
+// temps[k] (its acceptance tables and statistics are those of temps[k]),
+// while the configuration it holds wanders in temperature. Each configuration
+// is tracked as a "walker" to measure round trips between the lowest and the
+// highest temperature.
+
+class ReplicaExchange {
+
+  public:
+
+  /*==========================================================================*/
+
+  /* MEMBER VARIABLES */
+
+  // Number of temperatures (replicas)
+  int NUM_REPLICAS;
+
+  // Temperatures, in increasing order
+  // temps[NUM_REPLICAS]
+  double* temps;
+
+  // Models, replicas[k] being at temperature temps[k]
+  // replicas[NUM_REPLICAS]
+  IsingModel** replicas;
+
+  // Generations between exchange attempts
+  int SWAP_EVERY;
+
+  // Random number generator for the exchanges, and seed of all replicas
+  uint64_t seed;
+  IsingRNG rng;
+
+  // Current generation
+  int cur_gen;
+
+  // Exchange attempts so far; even attempts pair replicas (0,1), (2,3), ...
+  // and odd ones (1,2), (3,4), ...
+  int num_swaps;
+
+  // Exchange statistics of the pair of replicas (k,k+1), at index k
+  // swap_tries[NUM_REPLICAS], swap_accepts[NUM_REPLICAS]
+  int* swap_tries;
+  int* swap_accepts;
+
+  // Walker (configuration) currently held by replica k
+  // walker[NUM_REPLICAS]
+  int* walker;
+
+  // Per walker: direction (+1 if it last visited the lowest temperature, -1
+  // if the highest, 0 if neither yet), generation when it last left the
+  // lowest temperature, and completed round trips with their total length
+  // in generations
+  // walker_dir, trip_start, round_trips, trip_gens: [NUM_REPLICAS]
+  int* walker_dir;
+  int* trip_start;
+  int* round_trips;
+  double* trip_gens;
+
+  /*==========================================================================*/
+
+  /* MEMBER FUNCTIONS */
+
+  ReplicaExchange(int, int, const double*);
+  ~ReplicaExchange();
+  void setSeed(uint64_t);
+  void setDynamics(int);
+  void setFlipStrategy(int);
+  void randomizeDead(double);
+  void reset_stats();
+  void doGeneration();
+  void attemptSwaps();
+  void exchange(int);
+  void track_walkers();
+  double acceptance_rate(int);
+  void report();
+
+};
+
+#endif // REPLICA_EXCHANGE_H
@@ -0,0 +1,201 @@
+#ifndef SERIES_H
+#define SERIES_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include "AsyncWriter.h"
+
+// Buffered binary time-series files.
+
+// A series file starts with a text header of exactly SERIES_HEADER_SIZE
+// bytes: '#'-prefixed lines describing the run, padded with spaces and ending
+// with a newline (so "head" shows it). It is followed by fixed-size records
+// of three little-endian columns:
+//   gen    int64    generation
+//   magn   float64  global magnetization
+//   energy float64  global energy per cell
+// so that the data can be loaded with numpy.fromfile(..., offset=4096) (see
+// series.py). Records are buffered in memory and written in large chunks,
+// optionally on a background thread (see AsyncWriter).
+
+/*============================================================================*/
+
+// Size in bytes of the text header
+const int SERIES_HEADER_SIZE = 4096;
+
+// Records buffered before each write
+const int SERIES_BUFFER = 4096;
+
+// One record of a series file (24 bytes, no padding)
+struct SeriesRecord {
+  int64_t gen;
+  double magn;
+  double energy;
+};
+
+/*============================================================================*/
+
+/*===============\
+| Series writer |
+\===============*/
+
+struct SeriesWriter {
+
+  FILE* file;
+
+  // Only generations that are multiples of every are recorded
+  int every;
+
+  // Buffered records
+  // buffer[SERIES_BUFFER]
+  SeriesRecord* buffer;
+  int nbuf;
+
+  // Background writer (NULL to write synchronously)
+  // The record buffer is then taken from its pool (abuf), and handed over
+  // to it when full.
+  AsyncWriter* async;
+  AsyncBuffer abuf;
+
+  // False once a write has failed, so that records may be missing
+  bool ok;
+
+  SeriesWriter () {
+    ok = true;
+    file = NULL;
+    buffer = NULL;
+    nbuf = 0;
+    every = 1;
+    async = NULL;
+  }
+
+  ~SeriesWriter () {
+    close();
+  }
+
+  // Opens (truncates) the series file with a blank header, recording every
+  // p_every generations and writing through p_async if not NULL; returns
+  // false on failure
+  bool open (const char* fname, int p_every, AsyncWriter* p_async = NULL) {
+    close();
+    file = fopen(fname, "wb");
+    if (!file) return false;
+    every = p_every > 0 ? p_every : 1;
+    async = p_async;
+    nbuf = 0;
+    ok = true;
+    set_header("");
+    return true;
+  }
+
+  // Reopens an existing series file to continue it, keeping its header and
+  // its first keep records (any later ones are dropped); returns false on
+  // failure or if the file has fewer records
+  bool reopen (const char* fname, int p_every, long keep, AsyncWriter* p_async = NULL) {
+    long size;
+    close();
+    file = fopen(fname, "r+b");
+    if (!file) return false;
+    size = SERIES_HEADER_SIZE + keep*(long)sizeof(SeriesRecord);
+    fseek(file, 0, SEEK_END);
+    if (ftell(file) < size || ftruncate(fileno(file), size) != 0) {
+      fclose(file);
+      file = NULL;
+      return false;
+    }
+    fseek(file, 0, SEEK_END);
+    every = p_every > 0 ? p_every : 1;
+    async = p_async;
+    nbuf = 0;
+    ok = true;
+    return true;
+  }
+
+  // Writes (or rewrites) the text header
+  // The text is truncated if needed to fit; it should end with a newline.
+  void set_header (const char* text) {
+    char header[SERIES_HEADER_SIZE];
+    int len = strlen(text);
+    if (len > SERIES_HEADER_SIZE-1) len = SERIES_HEADER_SIZE-1;
+    memset(header, ' ', SERIES_HEADER_SIZE);
+    memcpy(header, text, len);
+    header[SERIES_HEADER_SIZE-1] = '\n';
+    if (async) {
+      AsyncBuffer hbuf = async->acquire(SERIES_HEADER_SIZE);
+      memcpy(hbuf.data, header, SERIES_HEADER_SIZE);
+      async->submit(file, hbuf, SERIES_HEADER_SIZE, 0);
+    } else {
+      fseek(file, 0, SEEK_SET);
+      if (fwrite(header, 1, SERIES_HEADER_SIZE, file) != SERIES_HEADER_SIZE) ok = false;
+      fseek(file, 0, SEEK_END);
+    }
+  }
+
+  // Records the state at generation gen (if a multiple of every)
+  inline void record (int64_t gen, double magn, double energy) {
+    if (gen % every != 0) return;
+    if (!buffer) {
+      if (async) {
+        abuf = async->acquire(SERIES_BUFFER*sizeof(SeriesRecord));
+        buffer = (SeriesRecord*) abuf.data;
+      } else {
+        buffer = (SeriesRecord*) malloc(SERIES_BUFFER*sizeof(SeriesRecord));
+      }
+    }
+    buffer[nbuf].gen = gen;
+    buffer[nbuf].magn = magn;
+    buffer[nbuf].energy = energy;
+    nbuf++;
+    if (nbuf == SERIES_BUFFER) flush();
+  }
+
+  // Writes out the buffered records (or queues them, returning the buffer)
+  void flush () {
+    if (async) {
+      if (buffer) async->submit(file, abuf, nbuf*sizeof(SeriesRecord), -1);
+      buffer = NULL;
+    } else if (nbuf > 0) {
+      if (fwrite(buffer, sizeof(SeriesRecord), nbuf, file) != (size_t) nbuf) ok = false;
+    }
+    nbuf = 0;
+  }
+
+  // Makes sure all records so far have reached the file (e.g. before a
+  // checkpoint); returns false if any write has failed
+  // With a background writer, a failure of any of its files counts.
+  bool sync () {
+    flush();
+    if (async) {
+      async->drain();
+      if (!async->ok()) ok = false;
+    }
+    if (fflush(file) != 0) ok = false;
+    return ok;
+  }
+
+  // Closes the file; returns false if any write (or closing it) has failed
+  // With a background writer, the closing is only queued: check its ok()
+  // after draining it.
+  bool close () {
+    bool result = ok;
+    if (file) {
+      flush();
+      if (async) async->close(file);
+      else if (fclose(file) != 0) ok = false;
+      result = ok;
+    }
+    file = NULL;
+    if (!async) free(buffer);
+    buffer = NULL;
+    async = NULL;
+    return result;
+  }
+
+};
+
+/*============================================================================*/
+
+#endif // SERIES_H
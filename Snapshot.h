@@ -0,0 +1,276 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include "IsingModel.h"
+#include "MSCIsingModel.h"
+#include "AsyncWriter.h"
+
+// Binary, bit-packed grid snapshots.
+
+// A snapshot file is a sequence of snapshots, each made of a fixed-size
+// SnapshotHeader followed by the packed grid: NGRID rows of row_bytes =
+// ceil(NGRID/8) bytes each, where bit j%8 (least significant first) of byte
+// j/8 of row i is 1 if cell (i,j) has spin +1 and 0 otherwise (spin -1, or a
+// dead cell). If the flags of the header have SNAPSHOT_DEAD_MASK set, the
+// grid is followed by a dead cell mask packed the same way, where a bit is 1
+// if the cell is dead (spin 0); it is set for the grids of an IsingModel
+// with dead cells, and is the same for all the snapshots of a file. Padding
+// bits at the end of each row are 0. All numbers are little-endian. The
+// reader is snapshot.py (which also reads the version 1 files, whose 40-byte
+// header ends at seed and which have no dead cell mask).
+
+// Implementations are in this header file because they use templates.
+
+/*============================================================================*/
+
+// Snapshot format version, stored in every header
+const uint32_t SNAPSHOT_VERSION = 2;
+
+// Header flag: the packed grid is followed by a dead cell mask
+const uint32_t SNAPSHOT_DEAD_MASK = 1;
+
+// Fixed header preceding every snapshot (48 bytes, no padding)
+struct SnapshotHeader {
+  char magic[4];       // "ISNP"
+  uint32_t version;    // SNAPSHOT_VERSION
+  uint32_t ngrid;      // NGRID
+  uint32_t row_bytes;  // Bytes per packed row, (NGRID+7)/8
+  double temp;         // Temperature
+  uint64_t gen;        // Generation
+  uint64_t seed;       // Seed of the run
+  uint32_t flags;      // SNAPSHOT_DEAD_MASK or 0
+  uint32_t reserved;   // 0
+};
+
+/*============================================================================*/
+
+// Size in bytes of one snapshot (header, packed grid and dead cell mask if
+// flagged) of an NGRID x NGRID grid
+inline size_t snapshot_bytes (int ngrid, uint32_t flags) {
+  size_t grid = (size_t) ngrid*((ngrid+7)/8);
+  return sizeof(SnapshotHeader) + ((flags & SNAPSHOT_DEAD_MASK) ? 2*grid : grid);
+}
+
+// Header flags of the snapshots of a model: only an IsingModel with dead
+// cells has a dead cell mask
+template<class MODEL>
+inline uint32_t snapshot_flags (MODEL&) {
+  return 0;
+}
+
+inline uint32_t snapshot_flags (IsingModel& model) {
+  return model.useDeadCells ? SNAPSHOT_DEAD_MASK : 0;
+}
+
+/*============================================================================*/
+
+// Packs row i of the grid of the model into out[row_bytes]
+template<class MODEL>
+void snapshot_pack_row (MODEL& model, int i, uint8_t* out) {
+  int j, b, ngrid;
+  uint8_t byte;
+  ngrid = model.NGRID;
+  for (j = 0; j < ngrid; j += 8) {
+    byte = 0;
+    for (b = 0; b < 8 && j+b < ngrid; b++) {
+      byte |= (model.get_spin(i, j+b) > 0) << b;
+    }
+    out[j/8] = byte;
+  }
+}
+
+// The multi-spin-coded grid is already packed with the same bit order (and
+// zeroed unused bits), so on little-endian machines its rows are copied
+template<>
+inline void snapshot_pack_row<MSCIsingModel> (MSCIsingModel& model, int i, uint8_t* out) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  memcpy(out, &model.words[i*model.NWORDS], (model.NGRID+7)/8);
+#else
+  int j;
+  memset(out, 0, (model.NGRID+7)/8);
+  for (j = 0; j < model.NGRID; j++) {
+    if (model.get_spin(i,j) > 0) out[j/8] |= 1 << (j%8);
+  }
+#endif
+}
+
+// Packs the dead cell mask of row i of the grid of the model into
+// out[row_bytes]
+template<class MODEL>
+void snapshot_pack_dead_row (MODEL& model, int i, uint8_t* out) {
+  int j, b, ngrid;
+  uint8_t byte;
+  ngrid = model.NGRID;
+  for (j = 0; j < ngrid; j += 8) {
+    byte = 0;
+    for (b = 0; b < 8 && j+b < ngrid; b++) {
+      byte |= (model.get_spin(i, j+b) == 0) << b;
+    }
+    out[j/8] = byte;
+  }
+}
+
+/*============================================================================*/
+
+/*=================\
+| Snapshot writer |
+\=================*/
+
+// Writes snapshots of a model to a file
+// The whole snapshot is packed into a buffer and written with a single
+// fwrite, so a dump costs a small fraction of a sweep. With a background
+// writer (see AsyncWriter) the grid is packed into one of its pooled buffers
+// and written on its thread, so only the packing is left on the simulation.
+struct SnapshotWriter {
+
+  FILE* file;
+
+  // Header and packed grid of the snapshot being written (synchronous mode)
+  // buffer[sizeof(SnapshotHeader) + NGRID*row_bytes]
+  uint8_t* buffer;
+  size_t size;
+
+  // Background writer (NULL to write synchronously)
+  AsyncWriter* async;
+
+  // False once a write has failed, so that snapshots may be missing
+  bool ok;
+
+  SnapshotWriter () {
+    ok = true;
+    file = NULL;
+    buffer = NULL;
+    size = 0;
+    async = NULL;
+  }
+
+  ~SnapshotWriter () {
+    close();
+  }
+
+  // Opens (truncates) the snapshot file, writing through p_async if not
+  // NULL; returns false on failure
+  bool open (const char* fname, AsyncWriter* p_async = NULL) {
+    close();
+    file = fopen(fname, "wb");
+    async = p_async;
+    ok = true;
+    return file != NULL;
+  }
+
+  // Reopens an existing snapshot file to continue it, keeping its first keep
+  // snapshots of an NGRID x NGRID grid (any later ones are dropped); returns
+  // false on failure or if the file has fewer snapshots
+  // The size of the snapshots is given by the flags of the first one.
+  bool reopen (const char* fname, int ngrid, long keep, AsyncWriter* p_async = NULL) {
+    SnapshotHeader first;
+    uint32_t flags;
+    long size;
+    close();
+    file = fopen(fname, "r+b");
+    if (!file) return false;
+    flags = 0;
+    if (fread(&first, sizeof(SnapshotHeader), 1, file) == 1) flags = first.flags;
+    size = keep*(long)snapshot_bytes(ngrid, flags);
+    fseek(file, 0, SEEK_END);
+    if (ftell(file) < size || ftruncate(fileno(file), size) != 0) {
+      fclose(file);
+      file = NULL;
+      return false;
+    }
+    fseek(file, 0, SEEK_END);
+    async = p_async;
+    ok = true;
+    return true;
+  }
+
+  // Makes sure all snapshots so far have reached the file; returns false if
+  // any write has failed (with a background writer, of any of its files)
+  bool sync () {
+    if (async) {
+      async->drain();
+      if (!async->ok()) ok = false;
+    }
+    if (fflush(file) != 0) ok = false;
+    return ok;
+  }
+
+  // Closes the file; returns false if any write (or closing it) has failed
+  // With a background writer, the closing is only queued: check its ok()
+  // after draining it.
+  bool close () {
+    bool result = ok;
+    if (file) {
+      if (async) async->close(file);
+      else if (fclose(file) != 0) ok = false;
+      result = ok;
+    }
+    file = NULL;
+    free(buffer);
+    buffer = NULL;
+    size = 0;
+    async = NULL;
+    return result;
+  }
+
+  // Appends a snapshot of the current grid of the model
+  template<class MODEL>
+  void write (MODEL& model, double temp, uint64_t gen, uint64_t seed) {
+
+    SnapshotHeader header;
+    AsyncBuffer abuf;
+    uint32_t row_bytes, flags;
+    uint8_t* rows;
+    int i;
+
+    row_bytes = (model.NGRID+7)/8;
+    flags = snapshot_flags(model);
+    size = snapshot_bytes(model.NGRID, flags);
+    if (async) {
+      abuf = async->acquire(size);
+      buffer = abuf.data;
+    } else if (!buffer) {
+      buffer = (uint8_t*) malloc(size);
+    }
+
+    memcpy(header.magic, "ISNP", 4);
+    header.version = SNAPSHOT_VERSION;
+    header.ngrid = model.NGRID;
+    header.row_bytes = row_bytes;
+    header.temp = temp;
+    header.gen = gen;
+    header.seed = seed;
+    header.flags = flags;
+    header.reserved = 0;
+    memcpy(buffer, &header, sizeof(SnapshotHeader));
+
+    rows = buffer + sizeof(SnapshotHeader);
+    for (i = 0; i < model.NGRID; i++) {
+      snapshot_pack_row(model, i, rows + (size_t) i*row_bytes);
+    }
+    if (flags & SNAPSHOT_DEAD_MASK) {
+      rows += (size_t) model.NGRID*row_bytes;
+      for (i = 0; i < model.NGRID; i++) {
+        snapshot_pack_dead_row(model, i, rows + (size_t) i*row_bytes);
+      }
+    }
+
+    if (async) {
+      async->submit(file, abuf, size, -1);
+      buffer = NULL;
+    } else if (fwrite(buffer, 1, size, file) != size) {
+      ok = false;
+    }
+
+  }
+
+};
+
+/*============================================================================*/
+
+#endif // SNAPSHOT_H
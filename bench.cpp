@@ -0,0 +1,372 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <iostream>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "IsingModel.h"
+#include "MSCIsingModel.h"
+#include "BatchIsingModel.h"
+#include "AsyncWriter.h"
+#include "Series.h"
+#include "Snapshot.h"
+#include "utils.h"
+using namespace std;
+
+// Benchmark suite of the simulation engines.
+
+// Times full generations of IsingModel for every flip strategy, dynamics and
+// dead cell setting, and of MSCIsingModel and BatchIsingModel for comparison,
+// over a range of grid sizes, as well as the cost of update_energy,
+// update_magnetization and the series and snapshot dumps. Results are
+// written as CSV (one row per measurement) so that runs can be compared to
+// track regressions; progress goes to stderr. Build and run it with
+// "make bench".
+
+// CSV columns:
+//   engine        spin, msc or batch
+//   test          sweep (a full generation) or the name of the operation
+//   strategy      flip strategy (- if not applicable)
+//   dynamics      transition dynamics (- if not applicable)
+//   dead_dens     density of dead cells
+//   ngrid         NGRID
+//   threads       maximum number of OpenMP threads
+//   reps          number of generations or operations timed
+//   seconds       total time of the reps
+//   flips_per_ns  spin-flip attempts per nanosecond (sweeps only)
+//   sweeps_per_s  lattice sweeps per second (sweeps only)
+//   ns_per_op     nanoseconds per generation or operation
+// A BatchIsingModel generation sweeps all its replicas, so it counts as
+// NUM_REPLICAS sweeps of NCELLS flip attempts each. A cluster generation
+// (Wolff or Swendsen-Wang) counts as one sweep of the live cells, and so
+// does an n-fold way generation (one sweep's worth of time).
+
+/*===================================*/
+
+/* BENCHMARK PARAMETERS */
+
+// Smallest and largest NGRID; the sizes are the powers of two in between
+// >> MAY BE OVERRIDDEN WITH THE -m AND -n OPTIONS
+int MIN_NGRID = 16;
+int MAX_NGRID = 8192;
+
+// Minimum time in seconds of each measurement
+// Generations (or operations) are repeated until it is reached, after one
+// warm-up generation.
+// >> MAY BE OVERRIDDEN WITH THE -t OPTION
+double MIN_TIME = 0.2;
+
+// Temperature of the benchmark runs
+// Acceptance rates (and so the cost of a sweep) depend on it; Tc is the
+// hardest case for the cluster dynamics.
+// >> MAY BE OVERRIDDEN WITH THE -T OPTION
+double TEMP = TEMP_CRIT;
+
+// Density of dead cells of the diluted runs (the other runs have none)
+// >> MAY BE OVERRIDDEN WITH THE -d OPTION
+double DEAD_DENS = 0.2;
+
+// Seed of the random number generator (fixed so runs are comparable)
+const uint64_t SEED = 12345;
+
+// Number of replicas of the BatchIsingModel runs
+const int BATCH_REPLICAS = BatchIsingModel::MAX_REPLICAS;
+
+// Names of the flip strategies and dynamics, indexed by their constants
+const int NUM_STRATEGIES = 8;
+const char* STRATEGY_NAMES[NUM_STRATEGIES] = {"shuffle", "random", "sequential", "peano", "copy", "checkerboard", "simd", "tiled"};
+const int NUM_DYNAMICS = 5;
+const char* DYNAMICS_NAMES[NUM_DYNAMICS] = {"metropolis", "glauber", "wolff", "swendsen_wang", "nfold"};
+
+// Output file
+FILE* out;
+
+/*===================================*/
+
+// Maximum number of OpenMP threads
+int max_threads() {
+#ifdef _OPENMP
+  return omp_get_max_threads();
+#else
+  return 1;
+#endif
+}
+
+/*===================================*/
+
+// Writes one row of results
+// flip_attempts and sweeps are per rep, and zero for operations.
+void report(const char* engine, const char* test, const char* strategy, const char* dynamics,
+            double dead_dens, int ngrid, long reps, double seconds, double flip_attempts, double sweeps) {
+  double ns = 1e9*seconds;
+  fprintf(out, "%s,%s,%s,%s,%.3f,%i,%i,%li,%.6f,", engine, test, strategy, dynamics,
+    dead_dens, ngrid, max_threads(), reps, seconds);
+  if (sweeps > 0) {
+    fprintf(out, "%.6g,%.6g,", reps*flip_attempts/ns, reps*sweeps/seconds);
+  } else {
+    fprintf(out, ",,");
+  }
+  fprintf(out, "%.6g\n", ns/reps);
+  fflush(out);
+  fprintf(stderr, "%-6s %-20s %-13s %-13s dead=%.2f n=%-5i %10.1f ns/op", engine, test, strategy,
+    dynamics, dead_dens, ngrid, ns/reps);
+  if (sweeps > 0) fprintf(stderr, " %8.4f flips/ns", reps*flip_attempts/ns);
+  fprintf(stderr, "\n");
+}
+
+/*===================================*/
+
+// Times generations of the model, after an untimed warm-up one
+// Returns the number of timed generations, and their time in seconds.
+// With recalibrate, the acceptance table is rebuilt (untimed) before every
+// generation. For DYNAMICS_WOLFF this restarts its calibration, so that every
+// generation flips (about) one sweep of cells: the number of clusters per
+// generation calibrated on a grid far from equilibrium, like the random start
+// of the benchmark, could otherwise make later generations many sweeps long.
+template<class MODEL>
+long time_generations(MODEL& model, bool recalibrate, double& seconds) {
+  long reps;
+  double start, now;
+  model.doGeneration();
+  reps = 0;
+  seconds = 0;
+  start = wall_time();
+  do {
+    if (recalibrate) {
+      now = wall_time();
+      model.update_acceptance();
+      start += wall_time() - now;
+    }
+    model.doGeneration();
+    reps++;
+    seconds = wall_time() - start;
+  } while (seconds < MIN_TIME);
+  return reps;
+}
+
+/*===================================*/
+
+// Times the operations of a model that don't depend on its dynamics:
+// update_energy, update_magnetization, writing its grid snapshot (packing it
+// and writing it synchronously, or handing it to a background writer), and
+// recording its series
+// Output goes to /dev/null, so only the cost on the simulation is measured.
+template<class MODEL, class VIEW>
+void time_operations(const char* engine, MODEL& model, VIEW& view, double dead_dens) {
+
+  long reps, k;
+  double start, seconds;
+  SnapshotWriter grids;
+  SeriesWriter series;
+  AsyncWriter* writer;
+
+  reps = 0;
+  start = wall_time();
+  do {
+    model.update_energy();
+    reps++;
+    seconds = wall_time() - start;
+  } while (seconds < MIN_TIME);
+  report(engine, "update_energy", "-", "-", dead_dens, model.NGRID, reps, seconds, 0, 0);
+
+  reps = 0;
+  start = wall_time();
+  do {
+    model.update_magnetization();
+    reps++;
+    seconds = wall_time() - start;
+  } while (seconds < MIN_TIME);
+  report(engine, "update_magnetization", "-", "-", dead_dens, model.NGRID, reps, seconds, 0, 0);
+
+  if (!grids.open("/dev/null")) {
+    fprintf(stderr, "Couldn't open /dev/null\n");
+    exit(1);
+  }
+  reps = 0;
+  start = wall_time();
+  do {
+    grids.write(view, TEMP, reps, SEED);
+    reps++;
+    seconds = wall_time() - start;
+  } while (seconds < MIN_TIME);
+  grids.close();
+  report(engine, "snapshot_write", "-", "-", dead_dens, model.NGRID, reps, seconds, 0, 0);
+
+  // Only the packing is timed here: in a run the writes overlap with the
+  // generations between dumps
+  writer = new AsyncWriter(4);
+  grids.open("/dev/null", writer);
+  reps = 0;
+  start = wall_time();
+  do {
+    grids.write(view, TEMP, reps, SEED);
+    reps++;
+    seconds = wall_time() - start;
+  } while (seconds < MIN_TIME);
+  grids.close();
+  delete writer;
+  report(engine, "snapshot_write_async", "-", "-", dead_dens, model.NGRID, reps, seconds, 0, 0);
+
+  // Records are cheap, so the clock is only read every SERIES_BUFFER of them
+  series.open("/dev/null", 1);
+  reps = 0;
+  start = wall_time();
+  do {
+    for (k = 0; k < SERIES_BUFFER; k++) {
+      series.record(reps+k, 0.0, 0.0);
+    }
+    reps += SERIES_BUFFER;
+    seconds = wall_time() - start;
+  } while (seconds < MIN_TIME);
+  series.close();
+  report(engine, "series_record", "-", "-", dead_dens, model.NGRID, reps, seconds, 0, 0);
+
+}
+
+/*===================================*/
+
+// Benchmarks IsingModel on an ngrid x ngrid grid with the given density of
+// dead cells (none if zero): every flip strategy with the single-spin
+// dynamics, the cluster and n-fold way dynamics, and the operations
+void bench_spin(int ngrid, double dead_dens) {
+
+  int s, d;
+  long reps;
+  double seconds;
+  IsingModel model(ngrid, TEMP);
+
+  model.setSeed(SEED);
+  if (dead_dens > 0) {
+    model.activateDeadCells();
+    model.randomizeDead(dead_dens);
+  }
+
+  for (d = 0; d < NUM_DYNAMICS; d++) {
+    for (s = 0; s < NUM_STRATEGIES; s++) {
+      // Cluster and n-fold way dynamics ignore the flip strategy
+      bool any_strategy = (d > IsingModel::DYNAMICS_GLAUBER);
+      if (any_strategy && s > 0) break;
+      model.flip_strategy = s;
+      model.setDynamics(d);
+      model.set_magnetization(0.0);
+      model.update_energy();
+      model.update_magnetization();
+      reps = time_generations(model, d == IsingModel::DYNAMICS_WOLFF, seconds);
+      report("spin", "sweep", any_strategy ? "-" : STRATEGY_NAMES[s], DYNAMICS_NAMES[d],
+        dead_dens, ngrid, reps, seconds, model.NLIVE, 1);
+    }
+  }
+
+  time_operations("spin", model, model, dead_dens);
+
+}
+
+/*===================================*/
+
+// Benchmarks MSCIsingModel on an ngrid x ngrid grid
+void bench_msc(int ngrid) {
+
+  int d;
+  long reps;
+  double seconds;
+  MSCIsingModel model(ngrid, TEMP);
+
+  model.setSeed(SEED);
+  for (d = IsingModel::DYNAMICS_METROPOLIS; d <= IsingModel::DYNAMICS_GLAUBER; d++) {
+    model.setDynamics(d);
+    model.set_magnetization(0.0);
+    model.update_energy();
+    model.update_magnetization();
+    reps = time_generations(model, false, seconds);
+    report("msc", "sweep", "-", DYNAMICS_NAMES[d], 0, ngrid, reps, seconds, model.NCELLS, 1);
+  }
+
+  time_operations("msc", model, model, 0);
+
+}
+
+/*===================================*/
+
+// Benchmarks BatchIsingModel with BATCH_REPLICAS replicas of an ngrid x
+// ngrid grid (the operations on all replicas, the snapshots of one)
+void bench_batch(int ngrid) {
+
+  int d;
+  long reps;
+  double seconds;
+  BatchIsingModel model(ngrid, TEMP, BATCH_REPLICAS);
+  BatchReplica replica(&model, 0);
+
+  model.setSeed(SEED);
+  for (d = IsingModel::DYNAMICS_METROPOLIS; d <= IsingModel::DYNAMICS_GLAUBER; d++) {
+    model.setDynamics(d);
+    model.set_magnetization(0.0);
+    model.update_energy();
+    model.update_magnetization();
+    reps = time_generations(model, false, seconds);
+    report("batch", "sweep", "-", DYNAMICS_NAMES[d], 0, ngrid, reps, seconds,
+      (double) model.NCELLS*model.NUM_REPLICAS, model.NUM_REPLICAS);
+  }
+
+  time_operations("batch", model, replica, 0);
+
+}
+
+/*===================================*/
+
+int main(int argc, char* argv[]) {
+
+  int opt, ngrid;
+  double start;
+  const char* fname = NULL;
+
+  // Read options
+  while ((opt = getopt(argc, argv, "m:n:t:T:d:o:")) != -1) {
+    switch (opt) {
+      case 'm': MIN_NGRID = atoi(optarg); break;
+      case 'n': MAX_NGRID = atoi(optarg); break;
+      case 't': MIN_TIME = atof(optarg); break;
+      case 'T': TEMP = atof(optarg); break;
+      case 'd': DEAD_DENS = atof(optarg); break;
+      case 'o': fname = optarg; break;
+      default:
+        cerr << "Usage: " << argv[0] << " [-m MIN_NGRID] [-n MAX_NGRID] [-t MIN_TIME] [-T TEMP] [-d DEAD_DENS] [-o FILE]" << endl;
+        return 1;
+    }
+  }
+  if (MIN_NGRID < 2 || MAX_NGRID < MIN_NGRID || TEMP <= 0 || DEAD_DENS < 0 || DEAD_DENS >= 1) {
+    cerr << "Invalid benchmark parameters!" << endl;
+    return 1;
+  }
+
+  if (fname) {
+    out = fopen(fname, "w");
+    if (!out) {
+      fprintf(stderr, "Couldn't open %s\n", fname);
+      return 1;
+    }
+  } else {
+    out = stdout;
+  }
+
+  start = wall_time();
+  fprintf(stderr, "Benchmarking NGRID %i to %i at T=%f, %i thread(s)\n", MIN_NGRID, MAX_NGRID, TEMP, max_threads());
+  fprintf(out, "engine,test,strategy,dynamics,dead_dens,ngrid,threads,reps,seconds,flips_per_ns,sweeps_per_s,ns_per_op\n");
+
+  for (ngrid = MIN_NGRID; ngrid <= MAX_NGRID; ngrid *= 2) {
+    bench_spin(ngrid, 0);
+    if (DEAD_DENS > 0) bench_spin(ngrid, DEAD_DENS);
+    // MSCIsingModel needs an even NGRID
+    if (ngrid % 2 == 0) bench_msc(ngrid);
+    bench_batch(ngrid);
+  }
+
+  fprintf(stderr, "Benchmark completed in %.1f s\n", wall_time() - start);
+  if (out != stdout) fclose(out);
+
+  return 0;
+
+}
@@ -3,9 +3,14 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
 #include <fstream>
 #include <iostream>
 #include "IsingModel.h"
+#include "MSCIsingModel.h"
+#include "BatchIsingModel.h"
+#include "Series.h"
+#include "Snapshot.h"
 #include "utils.h"
 using namespace std;
 
@@ -14,17 +19,74 @@ using namespace std;
 /* MODEL PARAMETERS */
 
 // Size of grid (NGRID x NGRID)
-const int NGRID = 100;
+// >> MAY BE OVERRIDDEN WITH THE -n OPTION
+int NGRID = 100;
 
-// Temperature (in units of J/k, so that Tc=2.2693706, dimensionless)
-// >> TEMPERATURE PASSED AS SOLE COMMAND LINE ARGUMENT
-double TEMP;
+// Temperatures (in units of J/k, so that Tc=2.2693706, dimensionless)
+// >> PASSED AS FIRST COMMAND LINE ARGUMENT
+// A comma-separated list whose items are single temperatures, "Tc", or
+// inclusive ranges START:STOP:STEP (see parse_temps). Every temperature is
+// simulated NUM_RUNS times.
+double* TEMPS;
+int NUM_TEMPS;
 
-// Number of generations to simulate per run
-const int NUM_GENS = 10000;
+// Largest temperature accepted (so that tags like T1000000.000 stay short)
+const double MAX_TEMP = 1e6;
 
-// Number of runs to simulate
-const int NUM_RUNS = 1;
+// Seed of the random number generator
+// >> OPTIONALLY PASSED AS SECOND COMMAND LINE ARGUMENT (default: current time)
+// Job j (run r at the t-th temperature, j = t*NUM_RUNS + r) uses seed SEED+j,
+// so run r of a single-temperature simulation uses seed SEED+r. With
+// ENGINE_BATCH, each batch of runs uses the seed of its first run.
+uint64_t SEED;
+
+// Number of generations to simulate per run (the maximum if TARGET_ERROR
+// is set)
+// >> MAY BE OVERRIDDEN WITH THE -g OPTION
+int NUM_GENS = 10000;
+
+// Target statistical error of <|M|>; zero to always run NUM_GENS generations
+// If set, a run stops as soon as it has equilibrated and the error of its
+// <|M|> after equilibration is at most this, as estimated by the models
+// online (see Binning.h); a batch of runs stops when all of them have. This
+// is checked every CONVERGENCE_EVERY generations.
+// >> MAY BE OVERRIDDEN WITH THE -E OPTION
+double TARGET_ERROR = 0.0;
+const int CONVERGENCE_EVERY = 100;
+
+// Number of runs to simulate per temperature
+// >> MAY BE OVERRIDDEN WITH THE -r OPTION
+int NUM_RUNS = 1;
+
+// Simulation engine
+// ENGINE_SPIN: the general IsingModel (one byte per spin, all options)
+// ENGINE_MSC: the multi-spin-coded MSCIsingModel (64 spins per word, much
+//             faster; requires even NGRID and ignores FLIP_STRATEGY)
+// ENGINE_BATCH: the batched BatchIsingModel, which simulates the runs of a
+//               temperature in batches of up to 64 replicas in lockstep (one
+//               bit per replica), each batch as a single job; much faster
+//               when NUM_RUNS is large. Ignores FLIP_STRATEGY.
+// >> MAY BE OVERRIDDEN WITH THE -e OPTION (spin, msc or batch)
+const int ENGINE_SPIN = 0;
+const int ENGINE_MSC = 1;
+const int ENGINE_BATCH = 2;
+int ENGINE = ENGINE_SPIN;
+
+// Flip strategy and transition dynamics
+// See IsingModel::doGeneration for the available strategies. Use
+// STRATEGY_CHECKERBOARD to spread each generation over all OpenMP threads,
+// and prefer STRATEGY_TILED to STRATEGY_SHUFFLE for grids that don't fit in
+// the cache (above about 2048 x 2048).
+// DYNAMICS_WOLFF and DYNAMICS_SWENDSEN_WANG (cluster flips, ENGINE_SPIN only)
+// ignore FLIP_STRATEGY and greatly reduce critical slowing down near Tc;
+// Swendsen-Wang is multithreaded, so prefer it for large grids.
+// DYNAMICS_NFOLD (rejection-free continuous-time Metropolis, ENGINE_SPIN
+// only) ignores it too, and is much faster well below Tc (T < ~1.5), where
+// nearly all flip attempts are rejected. Its generations are intervals of
+// NFOLD_STEP sweeps of physical time.
+const int FLIP_STRATEGY = IsingModel::STRATEGY_SHUFFLE;
+const int DYNAMICS = IsingModel::DYNAMICS_METROPOLIS;
+const double NFOLD_STEP = 1.0;
 
 // Initial magnetization -- determines how the initial spin states are set
 // Accepted values for INIT_MAGN_MODE: INIT_MAGN_AUTO or INIT_MAGN_MANUAL
@@ -42,174 +104,687 @@ const float INIT_MAGN = 0.0;
 // Data directory -- trailing slash optional
 const char datadir[] = ".";
 
+// Generations between time series records; zero for no series files
+// The series is written to <tag>_series.bin in a buffered binary format (see
+// Series.h; read it with series.py). Set above 1 to decimate long runs. The
+// summary of each run (<tag>_summary.csv, see write_summary) is written
+// regardless, so production runs that only need the equilibrium averages
+// and their errors can do without the series.
+// >> MAY BE OVERRIDDEN WITH THE -s OPTION
+int SERIES_EVERY = 1;
+
+// Generations between checkpoints of the full model state (see
+// IsingModel::saveCheckpoint) to <tag>.ckp; zero for no checkpoints
+// >> MAY BE OVERRIDDEN WITH THE -c OPTION
+int CHECKPOINT_EVERY = 0;
+
+// Resume runs from their checkpoints?
+// If set, every run with a checkpoint continues from it instead of starting
+// over, truncating its output files to the checkpointed generation; runs
+// without one start from scratch. With the same options (and number of
+// threads) the result is identical to an uninterrupted run. NUM_GENS may be
+// raised to extend finished runs.
+// >> SET WITH THE -R OPTION
+bool RESUME = false;
+
+// Write output files on a background thread?
+// If so, the series and grid dumps are handed over to an output thread (see
+// AsyncWriter) through OUTPUT_BUFFERS pooled buffers (plus one per series file),
+// and the simulation only waits for it when all buffers are in use.
+const bool ASYNC_OUTPUT = true;
+const int OUTPUT_BUFFERS = 4;
+
 // Generations between full grid dumps
+// Grids are written as bit-packed binary snapshots to <tag>_grids.bin (see
+// Snapshot.h; read them with snapshot.py).
 // Set this value to zero for no grid dumps
 const int DUMP_GRID_EVERY = 1000;
 
 /*===================================*/
 
-int main(int argc, char* argv[]) {
+// Initial magnetization at temperature temp (see INIT_MAGN_MODE)
+double initial_magnetization(double temp) {
+  if (INIT_MAGN_MODE == INIT_MAGN_MANUAL) {
+    return INIT_MAGN;
+  } else if (temp < TEMP_CRIT) {
+    return pow(1 - pow(sinh(2/temp), -4), 0.125);
+  } else {
+    return 0.0;
+  }
+}
 
-  int gen, run;
-  clock_t sclock, rclock, lclock;
-  time_t ltime;
-  double elapsed;
-  double _init_magn;
-  char fname[192];
-  char datadir2[128];
-  char tempstr[7];
-  ofstream seriesfile, gridsfile;
+/*===================================*/
 
-  sclock = clock();
+// Parses the temperature list of the command line into TEMPS and NUM_TEMPS
+// Items are separated by commas, and each can be a temperature, "Tc" (the
+// critical temperature) or an inclusive range START:STOP:STEP. For example,
+// "1.0:2.0:0.5,Tc,3" gives 1.0, 1.5, 2.0, Tc and 3.0.
+// Returns false if the list is not valid, or a temperature is not in
+// (0, MAX_TEMP].
+bool parse_temps(const char* arg) {
 
-  // Read temperature from command line
-  if (argc < 2) {
-    cerr << "Must provide temperature as first argument!" << endl;
-    return 1;
-  } else {
-    TEMP = atof(argv[1]);
+  char* buf;
+  char* item;
+  char* saveptr;
+  char* end;
+  double start, stop, step;
+  int n, k, len, size;
+
+  NUM_TEMPS = 0;
+  size = 16;
+  TEMPS = (double*) malloc(size*sizeof(double));
+  buf = strdup(arg);
+
+  for (item = strtok_r(buf, ",", &saveptr); item; item = strtok_r(NULL, ",", &saveptr)) {
+    if (strcmp(item, "Tc") == 0) {
+      start = stop = TEMP_CRIT;
+      n = 1;
+    } else if (sscanf(item, "%lf:%lf:%lf%n", &start, &stop, &step, &len) == 3
+               && item[len] == '\0') {
+      if (step <= 0 || stop < start) break;
+      // Tolerance so that STOP is included despite rounding
+      n = (int) floor((stop - start)/step + 1e-6) + 1;
+    } else {
+      start = strtod(item, &end);
+      if (end == item || *end != '\0') break;
+      n = 1;
+      step = 0;
+    }
+    while (NUM_TEMPS + n > size) {
+      size *= 2;
+      TEMPS = (double*) realloc(TEMPS, size*sizeof(double));
+    }
+    for (k = 0; k < n; k++) {
+      TEMPS[NUM_TEMPS++] = start + k*step;
+    }
   }
-  sprintf(tempstr, "T%.3f", TEMP);
 
-  // Remove slash to datadir if present
-  if (datadir[strlen(datadir)-1] == '/') {
-    strncat(datadir2, datadir, strlen(datadir)-1);
+  free(buf);
+  if (item != NULL || NUM_TEMPS == 0) return false;
+  for (k = 0; k < NUM_TEMPS; k++) {
+    if (!(TEMPS[k] > 0 && TEMPS[k] <= MAX_TEMP)) return false;
+  }
+  return true;
+
+}
+
+/*===================================*/
+
+// Per-replica access for do_run
+// The single-run engines hold one replica (one run), a BatchIsingModel
+// holds several.
+template<class MODEL>
+inline int num_replicas(MODEL&) {
+  return 1;
+}
+
+inline int num_replicas(BatchIsingModel& model) {
+  return model.NUM_REPLICAS;
+}
+
+template<class MODEL>
+inline double replica_magnetization(MODEL& model, int) {
+  return model.global_magnetization;
+}
+
+inline double replica_magnetization(BatchIsingModel& model, int r) {
+  return model.global_magnetization[r];
+}
+
+// Energy per cell
+template<class MODEL>
+inline double replica_energy(MODEL& model, int) {
+  return (double)(model.global_energy)/model.NCELLS;
+}
+
+inline double replica_energy(BatchIsingModel& model, int r) {
+  return (double)(model.global_energy[r])/model.NCELLS;
+}
+
+// Equilibration and error analysis of |M| and E (see Binning.h)
+template<class MODEL>
+inline EquilibriumStats& replica_equil(MODEL& model, int) {
+  return model.equil;
+}
+
+inline EquilibriumStats& replica_equil(BatchIsingModel& model, int r) {
+  return model.equil[r];
+}
+
+template<class MODEL>
+inline void write_snapshot(SnapshotWriter& file, MODEL& model, int, double temp, int gen) {
+  file.write(model, temp, gen, model.seed);
+}
+
+inline void write_snapshot(SnapshotWriter& file, BatchIsingModel& model, int r, double temp, int gen) {
+  BatchReplica replica(&model, r);
+  file.write(replica, temp, gen, model.seed);
+}
+
+#ifdef ISING_INSTRUMENT
+// Runtime counters of the model (see Instrument.h); only IsingModel has them
+template<class MODEL>
+inline IsingCounters* model_counters(MODEL&) {
+  return NULL;
+}
+
+inline IsingCounters* model_counters(IsingModel& model) {
+  return &model.counters;
+}
+#endif
+
+// Have all the replicas of the model reached TARGET_ERROR?
+template<class MODEL>
+bool target_reached(MODEL& model) {
+  for (int r = 0; r < num_replicas(model); r++) {
+    if (!replica_equil(model, r).reached(TARGET_ERROR)) return false;
+  }
+  return true;
+}
+
+// Writes the results of the error analysis of a run at temperature temp as
+// '#'-prefixed lines (for the series header)
+void equil_header(char* buf, int size, EquilibriumStats& ac, double ncells, double temp) {
+  int len;
+  double chi, chi_err, cv, cv_err, binder, binder_err;
+  if (ac.equilibrated) {
+    len = snprintf(buf, size, "# Equilibrated from generation %li\n", ac.equil_gen);
   } else {
-    strcpy(datadir2, datadir);
+    len = snprintf(buf, size, "# Not equilibrated (statistics of the last %li generations)\n", ac.magn.size());
   }
-  // Create model
-  IsingModel model(NGRID, TEMP);
+  if (len >= size) return;
+  ac.susceptibility(ncells, temp, chi, chi_err);
+  ac.specific_heat(ncells, temp, cv, cv_err);
+  ac.binder(ncells, temp, binder, binder_err);
+  snprintf(buf + len, size - len,
+    "# <|M|> = %f +- %f, tau_int = %.2f generations\n"
+    "# <E> = %f +- %f, tau_int = %.2f generations\n"
+    "# chi = %f +- %f, C = %f +- %f, U = %f +- %f\n",
+    ac.magn.mean(), ac.magn.error(), ac.magn.tau(),
+    ac.energy.mean(), ac.energy.error(), ac.energy.tau(),
+    chi, chi_err, cv, cv_err, binder, binder_err);
+}
 
-  // Determine initial magnetization
-  if (INIT_MAGN_MODE == INIT_MAGN_AUTO) {
-    if (TEMP < TEMP_CRIT) {
-      _init_magn = pow(1 - pow(sinh(2/TEMP), -4), 0.125);
-    } else {
-      _init_magn = 0.0;
-    }
-  } else if ((INIT_MAGN_MODE == INIT_MAGN_MANUAL)) {
-    _init_magn = INIT_MAGN;
+// Writes the summary of a run to fname: a CSV header line and one record
+// with its parameters, the means of the moments of the magnetization and
+// energy per cell with their errors and autocorrelation times (see
+// LogBinning), and the susceptibility, specific heat and Binder cumulant
+// with their jackknife errors (see JackknifeBins). The statistics cover
+// the generations since equilibration, or the last window if the run did
+// not equilibrate. Returns false on failure.
+bool write_summary(const char* fname, EquilibriumStats& ac, double ncells, double temp,
+                   uint64_t seed, int gens) {
+  FILE* fp;
+  double chi, chi_err, cv, cv_err, binder, binder_err;
+  const LogBinning* obs[5] = {&ac.magn, &ac.magn2, &ac.magn4, &ac.energy, &ac.energy2};
+  int k;
+  fp = fopen(fname, "w");
+  if (fp == NULL) return false;
+  ac.susceptibility(ncells, temp, chi, chi_err);
+  ac.specific_heat(ncells, temp, cv, cv_err);
+  ac.binder(ncells, temp, binder, binder_err);
+  fprintf(fp, "temp,seed,ngrid,gens,equilibrated,equil_gen,samples,"
+    "magn,magn_err,magn_tau,magn2,magn2_err,magn2_tau,magn4,magn4_err,magn4_tau,"
+    "energy,energy_err,energy_tau,energy2,energy2_err,energy2_tau,"
+    "chi,chi_err,cv,cv_err,binder,binder_err\n");
+  fprintf(fp, "%.6f,%llu,%i,%i,%i,%li,%li", temp, (unsigned long long) seed, NGRID, gens,
+    ac.equilibrated ? 1 : 0, ac.equil_gen, ac.magn.size());
+  for (k = 0; k < 5; k++) {
+    fprintf(fp, ",%.10g,%.4g,%.4g", obs[k]->mean(), obs[k]->error(), obs[k]->tau());
+  }
+  fprintf(fp, ",%.10g,%.4g,%.10g,%.4g,%.10g,%.4g\n", chi, chi_err, cv, cv_err, binder, binder_err);
+  return fclose(fp) == 0;
+}
+
+// Writes local time t into buf like asctime (with the trailing newline)
+// Reentrant, unlike asctime(localtime()), whose static buffers the parallel
+// jobs would share.
+void time_string(char* buf, int size, time_t t) {
+  struct tm tm;
+  localtime_r(&t, &tm);
+  if (strftime(buf, size, "%a %b %e %H:%M:%S %Y\n", &tm) == 0) buf[0] = '\0';
+}
+
+// Tag of run number run at the temperature with tag tempstr
+void run_tag(char* runtag, int size, const char* tempstr, int run) {
+  if (NUM_RUNS == 1) {
+    snprintf(runtag, size, "%s", tempstr);
   } else {
-    printf("INIT_MAGN_MODE must be either INIT_MAGN_AUTO or INIT_MAGN_MANUAL. Aborting.\n");
-    return 1;
+    snprintf(runtag, size, "%s_r%03i", tempstr, run);
   }
+}
 
-  printf("Temperature T=%f\n", TEMP);
-  printf("%i x %i Ising model\n", NGRID, NGRID);
-  printf("%i run%s\n", NUM_RUNS, NUM_RUNS > 1 ? "s" : "");
-  printf("%i generations\n", NUM_GENS);
-  printf("Datadir is %s/\n", datadir2);
+/*===================================*/
 
-  // Loop over runs
-  for (run = 0; run < NUM_RUNS; run++) {
+// Simulates the runs run0, run0+1, ... at temperature temp held by the
+// replicas of the given model (just run0 for the single-run engines),
+// writing the series, grid and summary files of each. Works with any engine exposing
+// the IsingModel interface (IsingModel, MSCIsingModel or BatchIsingModel).
+// Progress is only reported in detail when verbose; otherwise just the start
+// and end of the job.
+template<class MODEL>
+void do_run(MODEL& model, double temp, int run0, uint64_t seed, const char* datadir2, bool verbose) {
 
-    printf("\n=== Starting run %i/%i ===\n", run+1, NUM_RUNS);
-    rclock = clock();
-    ltime = time(NULL);
-    cout << asctime(localtime(&ltime));
+  int gen, gen0, r, nrep;
+  bool resumed, opened, stopped, synced;
+  double rstart, elapsed;
+  time_t ltime;
+  char timestr[32];
+  char tempstr[16], tag[48], runtag[48];
+  char fname[192], ckpname[192];
+  char header[SERIES_HEADER_SIZE];
+  int hlen;
+  SeriesWriter* seriesfiles;
+  SnapshotWriter* gridsfiles;
+  AsyncWriter* writer;
+#ifdef ISING_INSTRUMENT
+  // Counters of the model (NULL if it has none), and output timing
+  IsingCounters* counters = model_counters(model);
+  char summary[256];
+  double tio = 0;
+#endif
+
+  // The job is tagged like its run, or with its range of runs
+  nrep = num_replicas(model);
+  snprintf(tempstr, sizeof(tempstr), "T%.3f", temp);
+  if (NUM_RUNS == 1) {
+    snprintf(tag, sizeof(tag), "%s", tempstr);
+  } else if (nrep == 1) {
+    snprintf(tag, sizeof(tag), "%s_r%03i", tempstr, run0);
+  } else {
+    snprintf(tag, sizeof(tag), "%s_r%03i-%03i", tempstr, run0, run0+nrep-1);
+  }
 
-    // Reset model
+  if (verbose) {
+    if (nrep == 1) printf("\n=== Starting run %i/%i ===\n", run0+1, NUM_RUNS);
+    else printf("\n=== Starting runs %i-%i/%i ===\n", run0+1, run0+nrep, NUM_RUNS);
+  }
+  rstart = wall_time();
+  ltime = time(NULL);
+  time_string(timestr, sizeof(timestr), ltime);
+  if (verbose) cout << timestr;
+
+  // Resume from the checkpoint of this job, if asked to and there is one
+  snprintf(ckpname, sizeof(ckpname), "%s/%s.ckp", datadir2, tag);
+  resumed = false;
+  if (RESUME && access(ckpname, F_OK) == 0) {
+    if (!model.loadCheckpoint(ckpname)) {
+      fprintf(stderr, "Couldn't restore checkpoint %s\n", ckpname);
+      exit(1);
+    }
+    resumed = true;
+  }
+
+  // Otherwise reset model
+  if (!resumed) {
+    model.setSeed(seed);
     model.reset_stats();
     model.cur_gen = 0;
-    model.set_magnetization(_init_magn);
+    model.set_magnetization(initial_magnetization(temp));
     model.update_energy();
     model.update_magnetization();
+  }
+  gen0 = model.cur_gen;
 
-    // Open series file for this run and write header
-    if (NUM_RUNS == 1) {
-      sprintf(fname, "%s/%s_series.dat", datadir2, tempstr);
-    } else {
-      sprintf(fname, "%s/%s_r%03i_series.dat", datadir2, tempstr, run);
-    }
-    seriesfile.open(fname);
-    printf("Recording time series in file %s\n",fname);
-    seriesfile << "# " << asctime(localtime(&ltime));
-    seriesfile << "# Temperature = " << fixed << TEMP << "\n";
-    seriesfile << "# " << NGRID << " x " << NGRID << " grid\n";
-    seriesfile << "# Columns: Magnetization, Energy\n";
+  // Start the output thread, if used
+  // Every series file holds on to one buffer while filling it, so each
+  // replica adds one to the pool.
+  writer = ASYNC_OUTPUT ? new AsyncWriter(OUTPUT_BUFFERS + nrep) : NULL;
+
+  // Series header (see Series.h)
+  hlen = snprintf(header, SERIES_HEADER_SIZE,
+    "# %s"
+    "# Temperature = %f\n"
+    "# Seed = %llu\n"
+    "# %i x %i grid\n"
+    "# Every %i generations\n"
+    "# Columns: gen int64, magn float64, energy float64\n",
+    timestr, temp, (unsigned long long) model.seed,
+    NGRID, NGRID, SERIES_EVERY);
+  if (DYNAMICS == IsingModel::DYNAMICS_NFOLD) {
+    hlen += snprintf(header + hlen, SERIES_HEADER_SIZE - hlen,
+      "# N-fold way: a generation is %g sweeps of physical time\n", NFOLD_STEP);
+  }
+  if (nrep > 1) {
+    hlen += snprintf(header + hlen, SERIES_HEADER_SIZE - hlen,
+      "# Replica of a batch of runs %i-%i\n", run0, run0+nrep-1);
+  }
+  if (resumed) {
+    hlen += snprintf(header + hlen, SERIES_HEADER_SIZE - hlen,
+      "# Resumed from generation %i\n", gen0);
+  }
 
-    // Open grid file for this run and write header
+  // Open the series and grid snapshot files of every run (see Series.h and
+  // Snapshot.h). When resuming, the records after the checkpoint are dropped.
+  seriesfiles = new SeriesWriter[nrep];
+  gridsfiles = new SnapshotWriter[nrep];
+  for (r = 0; r < nrep; r++) {
+    run_tag(runtag, sizeof(runtag), tempstr, run0+r);
+    if (SERIES_EVERY > 0) {
+      snprintf(fname, sizeof(fname), "%s/%s_series.bin", datadir2, runtag);
+      if (resumed) {
+        opened = seriesfiles[r].reopen(fname, SERIES_EVERY, gen0/SERIES_EVERY + 1, writer);
+      } else {
+        opened = seriesfiles[r].open(fname, SERIES_EVERY, writer);
+      }
+      if (!opened) {
+        fprintf(stderr, "Couldn't open %s\n", fname);
+        exit(1);
+      }
+      if (verbose) printf("Recording time series in file %s\n",fname);
+      seriesfiles[r].set_header(header);
+    }
     if (DUMP_GRID_EVERY > 0) {
-      if (NUM_RUNS == 1) {
-        sprintf(fname, "%s/%s_grids.dat", datadir2, tempstr);
+      snprintf(fname, sizeof(fname), "%s/%s_grids.bin", datadir2, runtag);
+      if (verbose) printf("Recording grids in file %s\n",fname);
+      if (resumed) {
+        opened = gridsfiles[r].reopen(fname, NGRID, gen0/DUMP_GRID_EVERY + 1, writer);
       } else {
-        sprintf(fname, "%s/%s_r%03i_grids.dat", datadir2, tempstr, run);
+        opened = gridsfiles[r].open(fname, writer);
+      }
+      if (!opened) {
+        fprintf(stderr, "Couldn't open %s\n", fname);
+        exit(1);
       }
-      printf("Recording grids in file %s\n",fname);
-      gridsfile.open(fname);
-      gridsfile << "# " << asctime(localtime(&ltime));
-      gridsfile << "# Temperature = " << fixed << TEMP << "\n";
-      gridsfile << "# " << NGRID << " x " << NGRID << " grid\n";
     }
+  }
 
-    printf("Initial magnetization M=%f\n", model.global_magnetization);
+  if (verbose) {
+    if (resumed) printf("Resumed from %s at generation %i\n", ckpname, gen0);
+    else printf("Initial magnetization M=%f\n", replica_magnetization(model, 0));
     printf("Simulating %i generations ...\n", NUM_GENS);
+  } else if (resumed) {
+    printf("%s: resuming at generation %i\n", tag, gen0);
+  } else {
+    printf("%s: starting, seed %llu\n", tag, (unsigned long long) seed);
+  }
 
-    // Dump state and grid of start state
-    seriesfile << scientific << model.global_magnetization;
-    seriesfile << " " << (double)(model.global_energy)/model.NCELLS;
-    seriesfile << endl;
-    if (DUMP_GRID_EVERY > 0) {
-      gridsfile << "# GEN 0" << endl;
-      for (int i = 0; i < NGRID; i++) {
-        for (int j = 0; j < NGRID; j++) {
-          if (model.grid[i][j] == 1) gridsfile << 1;
-          else gridsfile << 0;
-          // if (j < NGRID - 1) gridsfile << " ";
-        }
-        gridsfile << endl;
+  // Dump state and grid of start state
+  if (!resumed) {
+    for (r = 0; r < nrep; r++) {
+      if (SERIES_EVERY > 0) {
+        seriesfiles[r].record(0, replica_magnetization(model, r), replica_energy(model, r));
+      }
+      if (DUMP_GRID_EVERY > 0) {
+        write_snapshot(gridsfiles[r], model, r, temp, 0);
       }
     }
-    elapsed = (double)(clock()-rclock)/CLOCKS_PER_SEC;
-    printf("[%.3f] gen 0 | M = %f | E = %f\n", elapsed, model.global_magnetization, ((double)model.global_energy)/model.NCELLS);
+  }
+  if (verbose) {
+    elapsed = wall_time() - rstart;
+    printf("[%.3f] gen %i | M = %f | E = %f\n", elapsed, gen0, replica_magnetization(model, 0), replica_energy(model, 0));
+  }
 
-    // Simulate NUM_GENS generations
-    for (gen = 1; gen <= NUM_GENS; gen++) {
-      model.doGeneration();
-      seriesfile << scientific << model.global_magnetization;
-      seriesfile << " " << (double)(model.global_energy)/model.NCELLS;
-      seriesfile << endl;
+  // Simulate up to NUM_GENS generations, or until TARGET_ERROR is reached
+  stopped = false;
+  for (gen = gen0+1; gen <= NUM_GENS; gen++) {
+    model.doGeneration();
+#ifdef ISING_INSTRUMENT
+    if (counters) tio = wall_time();
+#endif
+    for (r = 0; r < nrep; r++) {
+      if (SERIES_EVERY > 0) {
+        seriesfiles[r].record(gen, replica_magnetization(model, r), replica_energy(model, r));
+      }
       if (DUMP_GRID_EVERY > 0 && gen % DUMP_GRID_EVERY == 0) {
-        gridsfile << "# GEN " << gen << endl;
-        for (int i = 0; i < NGRID; i++) {
-          for (int j = 0; j < NGRID; j++) {
-            if (model.grid[i][j] == 1) gridsfile << 1;
-            else gridsfile << 0;
-            // if (j < NGRID - 1) gridsfile << " ";
-          }
-          gridsfile << endl;
-        }
+        write_snapshot(gridsfiles[r], model, r, temp, gen);
       }
-      if (gen % (NUM_GENS/10) == 0) {
-        elapsed = (double)(clock()-rclock)/CLOCKS_PER_SEC;
-        printf("[%.3f] gen %i | M = %f | E = %f\n", elapsed, gen, model.global_magnetization, ((double)model.global_energy)/model.NCELLS);
+    }
+    if (CHECKPOINT_EVERY > 0 && gen % CHECKPOINT_EVERY == 0) {
+      // A checkpoint is only written if all records and snapshots so far are
+      // in their files, since resuming truncates them to its generation
+      synced = true;
+      for (r = 0; r < nrep; r++) {
+        if (SERIES_EVERY > 0 && !seriesfiles[r].sync()) synced = false;
+        if (DUMP_GRID_EVERY > 0 && !gridsfiles[r].sync()) synced = false;
+      }
+      if (!synced) {
+        fprintf(stderr, "%s: couldn't write the series or grids, checkpoint %s not written\n", tag, ckpname);
+      } else if (!model.saveCheckpoint(ckpname)) {
+        fprintf(stderr, "%s: couldn't write checkpoint %s\n", tag, ckpname);
       }
     }
+#ifdef ISING_INSTRUMENT
+    if (counters) counters->time_io += wall_time() - tio;
+#endif
+    if (verbose && NUM_GENS >= 10 && gen % (NUM_GENS/10) == 0) {
+      elapsed = wall_time() - rstart;
+      printf("[%.3f] gen %i | M = %f | E = %f\n", elapsed, gen, replica_magnetization(model, 0), replica_energy(model, 0));
+#ifdef ISING_INSTRUMENT
+      if (counters) {
+        counters->summary_line(summary, sizeof(summary));
+        printf("[%.3f] counters: %s\n", elapsed, summary);
+      }
+#endif
+    }
+    if (TARGET_ERROR > 0 && gen % CONVERGENCE_EVERY == 0 && target_reached(model)) {
+      stopped = true;
+      break;
+    }
+  }
 
-    ltime = time(NULL);
-    elapsed = (double)(clock()-rclock)/CLOCKS_PER_SEC;
-    seriesfile << "# Finished " << asctime(localtime(&ltime));
-    seriesfile << "# Elapsed " << elapsed << " s";
-    seriesfile.close();
-    if (DUMP_GRID_EVERY > 0) {
-      gridsfile << "# Finished " << asctime(localtime(&ltime));
-      gridsfile << "# Elapsed " << elapsed << " s";
-      gridsfile.close();
+  ltime = time(NULL);
+  time_string(timestr, sizeof(timestr), ltime);
+  elapsed = wall_time() - rstart;
+  hlen += snprintf(header + hlen, SERIES_HEADER_SIZE - hlen, "# Finished %s# Elapsed %f s\n",
+    timestr, elapsed);
+  if (stopped && hlen < SERIES_HEADER_SIZE) {
+    hlen += snprintf(header + hlen, SERIES_HEADER_SIZE - hlen,
+      "# Stopped at generation %i: target error %g reached\n", gen, TARGET_ERROR);
+  }
+#ifdef ISING_INSTRUMENT
+  if (counters && hlen < SERIES_HEADER_SIZE) {
+    hlen += counters->summary_header(header + hlen, SERIES_HEADER_SIZE - hlen);
+  }
+#endif
+  for (r = 0; r < nrep; r++) {
+    run_tag(runtag, sizeof(runtag), tempstr, run0+r);
+    snprintf(fname, sizeof(fname), "%s/%s_summary.csv", datadir2, runtag);
+    if (!write_summary(fname, replica_equil(model, r), model.NCELLS, temp, model.seed, model.cur_gen)) {
+      fprintf(stderr, "%s: couldn't write summary %s\n", tag, fname);
+    }
+    if (SERIES_EVERY > 0) {
+      if (hlen < SERIES_HEADER_SIZE) {
+        equil_header(header + hlen, SERIES_HEADER_SIZE - hlen, replica_equil(model, r), model.NCELLS, temp);
+      }
+      seriesfiles[r].set_header(header);
+      if (!seriesfiles[r].close()) {
+        fprintf(stderr, "%s: couldn't write series of run %s, records may be missing\n", tag, runtag);
+      }
+    }
+    if (!gridsfiles[r].close()) {
+      fprintf(stderr, "%s: couldn't write grids of run %s, snapshots may be missing\n", tag, runtag);
     }
+  }
+  if (writer) {
+    writer->drain();
+    if (!writer->ok()) {
+      fprintf(stderr, "%s: background output failed, series records or snapshots may be missing\n", tag);
+    }
+  }
+  delete[] seriesfiles;
+  delete[] gridsfiles;
+  delete writer;
+  if (verbose) {
+    EquilibriumStats& ac = replica_equil(model, 0);
+    if (stopped) printf("Target error reached at generation %i\n", gen);
+    double chi, chi_err, cv, cv_err, binder, binder_err;
+    ac.susceptibility(model.NCELLS, temp, chi, chi_err);
+    ac.specific_heat(model.NCELLS, temp, cv, cv_err);
+    ac.binder(model.NCELLS, temp, binder, binder_err);
+    printf("<|M|> = %f +- %f, tau_int = %.2f generations (%s)\n", ac.magn.mean(), ac.magn.error(),
+      ac.magn.tau(), ac.equilibrated ? "equilibrated" : "not equilibrated");
+    printf("chi = %f +- %f | C = %f +- %f | U = %f +- %f\n", chi, chi_err, cv, cv_err, binder, binder_err);
     printf("%s", asctime(localtime(&ltime)));
     printf("Run completed in %.3f s\n", elapsed);
-    printf("=== Run %i/%i complete ===\n", run+1, NUM_RUNS);
+    if (nrep == 1) printf("=== Run %i/%i complete ===\n", run0+1, NUM_RUNS);
+    else printf("=== Runs %i-%i/%i complete ===\n", run0+1, run0+nrep, NUM_RUNS);
+  } else {
+    if (stopped) {
+      printf("%s: target error reached at generation %i\n", tag, gen);
+    }
+    printf("%s: completed in %.3f s | M = %f | E = %f\n", tag, elapsed, replica_magnetization(model, 0), replica_energy(model, 0));
+#ifdef ISING_INSTRUMENT
+    if (counters) {
+      counters->summary_line(summary, sizeof(summary));
+      printf("%s: counters: %s\n", tag, summary);
+    }
+#endif
+  }
+
+}
+
+/*===================================*/
+
+// Number of runs simulated by each job (see run_job)
+int runs_per_job() {
+  return (ENGINE == ENGINE_BATCH) ? BatchIsingModel::MAX_REPLICAS : 1;
+}
+
+/*===================================*/
+
+// Simulates job number job with the selected engine
+// The runs of each temperature are split into batches of runs_per_job()
+// runs (a single run except with ENGINE_BATCH), and each job is one batch.
+void run_job(int job, const char* datadir2, bool verbose) {
+  int batches = (NUM_RUNS + runs_per_job() - 1)/runs_per_job();
+  int t = job/batches;
+  int run0 = (job%batches)*runs_per_job();
+  double temp = TEMPS[t];
+  uint64_t seed = SEED + t*NUM_RUNS + run0;
+  if (ENGINE == ENGINE_BATCH) {
+    int nrep = NUM_RUNS - run0;
+    if (nrep > runs_per_job()) nrep = runs_per_job();
+    BatchIsingModel model(NGRID, temp, nrep);
+    model.setDynamics(DYNAMICS);
+    do_run(model, temp, run0, seed, datadir2, verbose);
+  } else if (ENGINE == ENGINE_MSC) {
+    MSCIsingModel model(NGRID, temp);
+    model.setDynamics(DYNAMICS);
+    do_run(model, temp, run0, seed, datadir2, verbose);
+  } else {
+    IsingModel model(NGRID, temp);
+    model.flip_strategy = FLIP_STRATEGY;
+    model.nfold_step = NFOLD_STEP;
+    model.setDynamics(DYNAMICS);
+    do_run(model, temp, run0, seed, datadir2, verbose);
+  }
+}
+
+/*===================================*/
+
+int main(int argc, char* argv[]) {
+
+  int opt, job, num_jobs;
+  double start, elapsed;
+  time_t ltime;
+  char datadir2[128];
+
+  start = wall_time();
+
+  // Read options, then temperatures and seed from command line
+  while ((opt = getopt(argc, argv, "n:g:r:e:c:RE:s:")) != -1) {
+    switch (opt) {
+      case 'n': NGRID = atoi(optarg); break;
+      case 'e':
+        if (strcmp(optarg, "spin") == 0) ENGINE = ENGINE_SPIN;
+        else if (strcmp(optarg, "msc") == 0) ENGINE = ENGINE_MSC;
+        else if (strcmp(optarg, "batch") == 0) ENGINE = ENGINE_BATCH;
+        else {
+          cerr << "Unknown engine " << optarg << " (must be spin, msc or batch)" << endl;
+          return 1;
+        }
+        break;
+      case 'g': NUM_GENS = atoi(optarg); break;
+      case 'r': NUM_RUNS = atoi(optarg); break;
+      case 'c': CHECKPOINT_EVERY = atoi(optarg); break;
+      case 'R': RESUME = true; break;
+      case 'E': TARGET_ERROR = atof(optarg); break;
+      case 's': SERIES_EVERY = atoi(optarg); break;
+      default:
+        cerr << "Usage: " << argv[0] << " [-n NGRID] [-g NUM_GENS] [-r NUM_RUNS] [-e ENGINE] [-c CHECKPOINT_EVERY] [-R] [-E TARGET_ERROR] [-s SERIES_EVERY] <TEMPS> [SEED]" << endl;
+        return 1;
+    }
+  }
+  if (optind >= argc) {
+    cerr << "Must provide temperature(s) as first argument!" << endl;
+    return 1;
+  }
+  if (!parse_temps(argv[optind])) {
+    cerr << "Invalid temperature list: " << argv[optind] << endl;
+    return 1;
+  }
+  if (NGRID < 1 || NUM_GENS < 1 || NUM_RUNS < 1) {
+    cerr << "NGRID, NUM_GENS and NUM_RUNS must be positive!" << endl;
+    return 1;
+  }
+  if ((ENGINE == ENGINE_MSC && NGRID > MSCIsingModel::MAX_NGRID) ||
+      (ENGINE == ENGINE_BATCH && NGRID > BatchIsingModel::MAX_NGRID)) {
+    cerr << "NGRID must be at most " << MSCIsingModel::MAX_NGRID << " with the msc and batch engines!" << endl;
+    return 1;
+  }
+  if (SERIES_EVERY < 0) {
+    cerr << "SERIES_EVERY must not be negative!" << endl;
+    return 1;
+  }
+  if (optind+1 < argc) {
+    SEED = strtoull(argv[optind+1], NULL, 10);
+  } else {
+    SEED = time(NULL);
+  }
+  if (INIT_MAGN_MODE != INIT_MAGN_AUTO && INIT_MAGN_MODE != INIT_MAGN_MANUAL) {
+    printf("INIT_MAGN_MODE must be either INIT_MAGN_AUTO or INIT_MAGN_MANUAL. Aborting.\n");
+    return 1;
+  }
 
+  // Remove slash to datadir if present
+  datadir2[0] = '\0';
+  if (datadir[strlen(datadir)-1] == '/') {
+    strncat(datadir2, datadir, strlen(datadir)-1);
+  } else {
+    strcpy(datadir2, datadir);
   }
 
-  if (NUM_RUNS > 1) {
+  if (NUM_TEMPS == 1) {
+    printf("Temperature T=%f\n", TEMPS[0]);
+  } else {
+    printf("%i temperatures from T=%f to T=%f\n", NUM_TEMPS, TEMPS[0], TEMPS[NUM_TEMPS-1]);
+  }
+  printf("%i x %i Ising model\n", NGRID, NGRID);
+  printf("%i run%s per temperature\n", NUM_RUNS, NUM_RUNS > 1 ? "s" : "");
+  if (TARGET_ERROR > 0) {
+    printf("Up to %i generations, until the error of <|M|> is %g\n", NUM_GENS, TARGET_ERROR);
+  } else {
+    printf("%i generations\n", NUM_GENS);
+  }
+  printf("Seed %llu\n", (unsigned long long) SEED);
+  printf("Datadir is %s/\n", datadir2);
+
+  // Do all (temperature, batch of runs) jobs
+  // Jobs are handed out to the OpenMP threads one at a time as they become
+  // free. A single job runs alone and may use all threads itself (see
+  // FLIP_STRATEGY); with several, each job runs on one thread.
+  num_jobs = NUM_TEMPS*((NUM_RUNS + runs_per_job() - 1)/runs_per_job());
+  if (num_jobs == 1) {
+    run_job(0, datadir2, true);
+  } else {
+    printf("\n=== Starting %i jobs ===\n", num_jobs);
+    #pragma omp parallel for schedule(dynamic,1)
+    for (job = 0; job < num_jobs; job++) {
+      run_job(job, datadir2, false);
+    }
+  }
+
+  if (num_jobs > 1) {
     printf("\n=== All runs complete! ===\n");
     ltime = time(NULL);
-    elapsed = (double)(clock()-sclock)/CLOCKS_PER_SEC;
+    elapsed = wall_time() - start;
     printf("Finished: %s", asctime(localtime(&ltime)));
     printf("Total elapsed: %.1f s\n", elapsed);
   }
 
+  free(TEMPS);
+
   return 0;
 
 }
@@ -1,27 +1,24 @@
 import os
 import sys
 import matplotlib.pyplot as plt
+from series import read_series
 
 fname = sys.argv[1]
 
-magn = []; energy = []
-with open(fname) as f:
-  for line in f:
-    if line.startswith("#"): continue
-    magn.append(float(line.split()[1]))
-    energy.append(float(line.split()[2]))
+header, data = read_series(fname)
+gen = data["gen"]; magn = data["magn"]; energy = data["energy"]
 
 # plt.figure(figsize=(10,4))
 plt.figure(figsize=(10,7))
 
 plt.subplot(2,1,1)
-plt.plot(magn, color="C0")
+plt.plot(gen, magn, color="C0")
 plt.xlabel("Generation")
 plt.title("Magnetization")
 plt.grid(ls=":")
 
 plt.subplot(2,1,2)
-plt.plot(energy, color="C1")
+plt.plot(gen, energy, color="C1")
 plt.xlabel("Generation")
 plt.title("Energy")
 plt.grid(ls=":")
@@ -0,0 +1,167 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fstream>
+#include <iostream>
+#include "IsingModel.h"
+#include "ReplicaExchange.h"
+#include "utils.h"
+using namespace std;
+
+/*===================================*/
+
+/* MODEL PARAMETERS */
+
+// Size of grid (NGRID x NGRID)
+const int NGRID = 100;
+
+// Temperatures (in units of J/k)
+// >> LOWEST TEMPERATURE, HIGHEST TEMPERATURE AND NUMBER OF TEMPERATURES
+// >> PASSED AS FIRST THREE COMMAND LINE ARGUMENTS
+// The temperatures are spaced geometrically, which gives roughly uniform
+// exchange acceptance rates away from Tc.
+double TEMP_MIN, TEMP_MAX;
+int NUM_TEMPS;
+
+// Seed of the random number generator
+// >> OPTIONALLY PASSED AS FOURTH COMMAND LINE ARGUMENT (default: current time)
+uint64_t SEED;
+
+// Number of generations to simulate
+const int NUM_GENS = 10000;
+
+// Generations between replica exchange attempts
+const int SWAP_EVERY = 1;
+
+// Flip strategy and transition dynamics of all replicas (see ising.cpp)
+// The replicas are advanced concurrently, one thread each.
+const int FLIP_STRATEGY = IsingModel::STRATEGY_SHUFFLE;
+const int DYNAMICS = IsingModel::DYNAMICS_METROPOLIS;
+
+// Data directory -- trailing slash optional
+const char datadir[] = ".";
+
+/*===================================*/
+
+int main(int argc, char* argv[]) {
+
+  int k, gen;
+  double start, elapsed, mean_rate;
+  double* temps;
+  time_t ltime;
+  char datadir2[128];
+  char fname[192];
+  ofstream* seriesfiles;
+
+  start = wall_time();
+
+  // Read temperatures from command line
+  if (argc < 4) {
+    cerr << "Usage: " << argv[0] << " <TEMP_MIN> <TEMP_MAX> <NUM_TEMPS> [SEED]" << endl;
+    return 1;
+  }
+  TEMP_MIN = atof(argv[1]);
+  TEMP_MAX = atof(argv[2]);
+  NUM_TEMPS = atoi(argv[3]);
+  if (NUM_TEMPS < 2 || TEMP_MIN <= 0 || TEMP_MAX <= TEMP_MIN) {
+    cerr << "Need at least 2 temperatures and 0 < TEMP_MIN < TEMP_MAX!" << endl;
+    return 1;
+  }
+  if (argc >= 5) {
+    SEED = strtoull(argv[4], NULL, 10);
+  } else {
+    SEED = time(NULL);
+  }
+  temps = (double*) malloc(NUM_TEMPS*sizeof(double));
+  for (k = 0; k < NUM_TEMPS; k++) {
+    temps[k] = TEMP_MIN*pow(TEMP_MAX/TEMP_MIN, k/(double)(NUM_TEMPS-1));
+  }
+
+  // Remove slash to datadir if present
+  datadir2[0] = '\0';
+  if (datadir[strlen(datadir)-1] == '/') {
+    strncat(datadir2, datadir, strlen(datadir)-1);
+  } else {
+    strcpy(datadir2, datadir);
+  }
+
+  printf("Replica exchange with %i temperatures in [%f, %f]\n", NUM_TEMPS, TEMP_MIN, TEMP_MAX);
+  printf("%i x %i Ising model\n", NGRID, NGRID);
+  printf("%i generations, exchanges every %i\n", NUM_GENS, SWAP_EVERY);
+  printf("Seed %llu\n", (unsigned long long) SEED);
+  printf("Datadir is %s/\n", datadir2);
+
+  // Create and initialize replicas (at the equilibrium magnetization, as in
+  // ising.cpp)
+  ReplicaExchange pt(NGRID, NUM_TEMPS, temps);
+  pt.SWAP_EVERY = SWAP_EVERY;
+  pt.setFlipStrategy(FLIP_STRATEGY);
+  pt.setDynamics(DYNAMICS);
+  pt.setSeed(SEED);
+  for (k = 0; k < NUM_TEMPS; k++) {
+    IsingModel* model = pt.replicas[k];
+    if (temps[k] < TEMP_CRIT) {
+      model->set_magnetization(pow(1 - pow(sinh(2/temps[k]), -4), 0.125));
+    } else {
+      model->set_magnetization(0.0);
+    }
+    model->update_energy();
+    model->update_magnetization();
+  }
+
+  // Open one series file per temperature and write headers
+  ltime = time(NULL);
+  seriesfiles = new ofstream[NUM_TEMPS];
+  for (k = 0; k < NUM_TEMPS; k++) {
+    sprintf(fname, "%s/T%.3f_pt_series.dat", datadir2, temps[k]);
+    seriesfiles[k].open(fname);
+    seriesfiles[k] << "# " << asctime(localtime(&ltime));
+    seriesfiles[k] << "# Temperature = " << fixed << temps[k] << "\n";
+    seriesfiles[k] << "# Replica exchange: " << NUM_TEMPS << " temperatures in [";
+    seriesfiles[k] << TEMP_MIN << ", " << TEMP_MAX << "]\n";
+    seriesfiles[k] << "# Seed = " << SEED << "\n";
+    seriesfiles[k] << "# " << NGRID << " x " << NGRID << " grid\n";
+    seriesfiles[k] << "# Columns: Magnetization, Energy\n";
+  }
+  printf("Recording time series in files %s/T*_pt_series.dat\n", datadir2);
+
+  // Simulate NUM_GENS generations
+  printf("Simulating %i generations ...\n", NUM_GENS);
+  for (gen = 1; gen <= NUM_GENS; gen++) {
+    pt.doGeneration();
+    for (k = 0; k < NUM_TEMPS; k++) {
+      seriesfiles[k] << scientific << pt.replicas[k]->global_magnetization;
+      seriesfiles[k] << " " << (double)(pt.replicas[k]->global_energy)/pt.replicas[k]->NCELLS;
+      seriesfiles[k] << endl;
+    }
+    if (gen % (NUM_GENS/10) == 0) {
+      mean_rate = 0.0;
+      for (k = 0; k < NUM_TEMPS-1; k++) {
+        mean_rate += pt.acceptance_rate(k)/(NUM_TEMPS-1);
+      }
+      elapsed = wall_time() - start;
+      printf("[%.3f] gen %i | mean exchange acceptance = %.3f\n", elapsed, gen, mean_rate);
+    }
+  }
+
+  ltime = time(NULL);
+  elapsed = wall_time() - start;
+  for (k = 0; k < NUM_TEMPS; k++) {
+    seriesfiles[k] << "# Exchange acceptance with next T = " << fixed << pt.acceptance_rate(k) << "\n";
+    seriesfiles[k] << "# Finished " << asctime(localtime(&ltime));
+    seriesfiles[k] << "# Elapsed " << elapsed << " s";
+    seriesfiles[k].close();
+  }
+  delete[] seriesfiles;
+
+  pt.report();
+  printf("%s", asctime(localtime(&ltime)));
+  printf("Completed in %.3f s\n", elapsed);
+
+  free(temps);
+
+  return 0;
+
+}
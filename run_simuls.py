@@ -1,4 +1,5 @@
 # Run a series of ising models
+# All temperatures are simulated concurrently by a single ising process.
 from math import log, sqrt
 import os
 import numpy as np
@@ -9,6 +10,10 @@ temperatures = [1.0, 1.1, 1.2, 1.3, 1.4, 1.5, 1.6, 1.7, 1.8, 1.9, 2.0, 2.1, 2.2,
 
 base_dir = "simuls"
 
+cmd = "./ising " + ",".join(str(T) for T in temperatures)
+print(cmd)
+os.system(cmd)
+
 for T in temperatures:
   
   if T == "Tc":
@@ -17,11 +22,7 @@ for T in temperatures:
   else:
     out_dir = os.path.join(base_dir, f"T{T:.1f}")
   os.makedirs(out_dir, exist_ok=True)
-  
-  cmd = f"./ising {T}"
-  print(cmd)
-  os.system(cmd)
 
-  cmd = f"mv T{T:.3f}_*.dat {out_dir}"
+  cmd = f"mv T{T:.3f}[._]* {out_dir}"
   print(cmd)
   os.system(cmd)
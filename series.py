@@ -0,0 +1,21 @@
+# Reader for the binary time series files written by ising (see Series.h)
+#
+# Usage:
+#   from series import read_series
+#   header, data = read_series("T2.000_series.bin")
+#   print(data["gen"], data["magn"], data["energy"])
+#
+# data is a numpy structured array loaded straight from the file.
+import numpy as np
+
+HEADER_SIZE = 4096
+RECORD_DTYPE = np.dtype([("gen", "<i8"), ("magn", "<f8"), ("energy", "<f8")])
+
+def read_series(fname):
+  """Returns (header, data): the header lines (without the leading '# ') and
+  the records as a structured array with fields gen, magn and energy"""
+  with open(fname, "rb") as f:
+    text = f.read(HEADER_SIZE).decode("ascii", errors="replace")
+  header = [line[2:] for line in text.splitlines() if line.startswith("#")]
+  data = np.fromfile(fname, dtype=RECORD_DTYPE, offset=HEADER_SIZE)
+  return header, data
@@ -0,0 +1,46 @@
+# Reader for the binary grid snapshot files written by ising (see Snapshot.h)
+#
+# Usage:
+#   from snapshot import read_snapshots
+#   for header, grid in read_snapshots("T2.000_grids.bin"):
+#     print(header["gen"], grid.mean())
+#
+# Each grid is an NGRID x NGRID array of int8 spins: +1 or -1, or 0 for the
+# dead cells of grids saved with a dead cell mask (version 2 files of runs
+# with dead cells). Version 1 files have no mask, so their dead cells read
+# as -1.
+import struct
+import numpy as np
+
+MAGIC = b"ISNP"
+HEADER_FMT = "<4sIIIdQQ"
+HEADER_SIZE = struct.calcsize(HEADER_FMT)
+# Fields added by version 2: flags and a reserved word
+HEADER2_FMT = "<II"
+HEADER2_SIZE = struct.calcsize(HEADER2_FMT)
+DEAD_MASK = 1
+
+def read_snapshots(fname):
+  """Yields (header, grid) for every snapshot in the file; header is a dict
+  with keys version, ngrid, temp, gen, seed and flags"""
+  with open(fname, "rb") as f:
+    while True:
+      raw = f.read(HEADER_SIZE)
+      if len(raw) < HEADER_SIZE: break
+      magic, version, ngrid, row_bytes, temp, gen, seed = struct.unpack(HEADER_FMT, raw)
+      if magic != MAGIC:
+        raise ValueError(f"{fname}: not a snapshot file (bad magic)")
+      flags = 0
+      if version >= 2:
+        raw = f.read(HEADER2_SIZE)
+        if len(raw) < HEADER2_SIZE: break
+        flags, _ = struct.unpack(HEADER2_FMT, raw)
+      planes = 2 if flags & DEAD_MASK else 1
+      data = f.read(planes*ngrid*row_bytes)
+      if len(data) < planes*ngrid*row_bytes: break
+      bits = np.unpackbits(np.frombuffer(data, dtype=np.uint8).reshape(planes*ngrid, row_bytes), axis=1, bitorder="little")
+      grid = 2*bits[:ngrid, :ngrid].astype(np.int8) - 1
+      if flags & DEAD_MASK:
+        grid[bits[ngrid:, :ngrid] == 1] = 0
+      header = {"version": version, "ngrid": ngrid, "temp": temp, "gen": gen, "seed": seed, "flags": flags}
+      yield header, grid
@@ -1,11 +1,15 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#include <time.h>
+
 // Simple implementations of quicksort and binary search, using templates to
 // have data type felixibility.
 
 // Implementations are in this header file because they use templates.
 
+// Also a wall clock for timing multithreaded runs.
+
 /*============================================================================*/
 
 /* Quicksort */
@@ -131,4 +135,18 @@ int do_search (TYPE data[], int left, int right, TYPE item) {
 
 /*============================================================================*/
 
+/*===========\
+| Wall clock |
+\===========*/
+
+// Wall-clock time in seconds, from an arbitrary origin
+// (clock() measures CPU time, which adds up all threads.)
+inline double wall_time () {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+/*============================================================================*/
+
 #endif // UTILS_H